@@ -15,6 +15,39 @@ struct Vertex
 	gml::vec2 texcoord;
 };
 
+struct Fragment;
+struct TriangleSetup;
+class ThreadPool;
+
+enum class RenderPipeline
+{
+	Staged,	//each stage runs over the whole frame, fragments are kept in between for debugging
+	Fused,	//every triangle is rasterized, shaded and merged tile by tile, nothing is stored
+	Binned,	//triangles are sorted into screen tiles, worker threads draw whole tiles in parallel
+};
+
+//color render targets, merged in float and converted on store.
+enum class ColorFormat
+{
+	RGBA32F,	//gml::color4, 16 bytes
+	RGBA16F,	//half floats, 8 bytes
+	RGB10A2,	//10 bit unorm color and 2 bit alpha, 4 bytes
+	RGBA8,		//8 bit unorm, 4 bytes
+};
+
+enum class DepthFormat
+{
+	D32F_S8,	//float depth and a separate stencil byte, 5 bytes
+	D24S8,		//24 bit unorm depth and stencil packed in one word, 4 bytes
+};
+
+//how CopyBuffer scales the color buffer to the output size.
+enum class ResolveFilter
+{
+	Point,
+	Bilinear,
+};
+
 class Renderer
 {
 public:
@@ -22,27 +55,122 @@ public:
 	~Renderer();
 	void Render();
 	void CopyBuffer(byte* buffer, int width, int height, int pitch);
+	void SetPipeline(RenderPipeline pipeline);
+
+	//fused and binned pipelines z-test before shading, and skip 16x16 blocks behind the stored depth.
+	//skipped blocks lose their stencil writes, so early z assumes fragments do not write stencil.
+	void SetEarlyZ(bool enabled);
+
+	//fused and binned pipelines write depth of all triangles first, then shade only the fragments
+	//that match it, so each pixel is shaded once. triangles have to be opaque, without alpha discard.
+	void SetDepthPrepass(bool enabled);
+
+	//changing a format reallocates the buffer, it is cleared again before the next use.
+	void SetColorFormat(ColorFormat format);
+	void SetDepthFormat(DepthFormat format);
+
+	//stores color, depth and stencil in 8x8 pixel micro tiles, CopyBuffer turns it back into rows.
+	void SetTiledLayout(bool enabled);
+
+	//CopyBuffer rounds to 8 bits, optionally through the srgb curve and with a 4x4 ordered dither.
+	void SetResolveFilter(ResolveFilter filter);
+	void SetResolveSrgb(bool enabled);
+	void SetResolveDither(bool enabled);
 
 private:
+	enum class DrawPass
+	{
+		Color,	//depth test, shading and merge in one go
+		Depth,	//depth only, for the pre-pass
+		Shade,	//fragments matching the depth of the pre-pass
+	};
+
 	void ClearBuffer();
+	gml::color4 ClearColor(int row) const;
+	void ClearTile(int tile, bool stream);
+	void ClearPendingTiles();
+	int PixelIndex(int x, int row) const;
+	void CreateColorBuffer();
+	void CreateDepthBuffer();
 	void VertexShader();
 	void Rasterization();
 	void PixelShader();
 	void OutputMerge();
+	void FusedPipeline();
+	void BinnedPipeline();
+	void DrawPixels(const TriangleSetup& setup, int x0, int y0, int x1, int y1, DrawPass pass);
+	bool EarlyDepthTest(const Fragment& f) const;
+	void RefreshHiZ(int hx, int hy);
+
+	bool SetupTriangle(int triangle, TriangleSetup& setup) const;
+	void InterpolateFragment(const TriangleSetup& setup, int x, int y, float u, float v, Fragment& f) const;
+	void ShadeFragment(const Fragment& f, Fragment& of) const;
+	bool ScissorTest(int x, int y) const;
+	void MergeFragment(const Fragment& f, bool depth_equal = false);
+
+	gml::color4 LoadColor(int index) const;
+	void StoreColor(int index, const gml::color4& color);
+	float LoadDepth(int index) const;
+	void StoreDepth(int index, float z);
+	bool DepthEqual(int index, float z) const;
+	byte LoadStencil(int index) const;
+	void StoreStencil(int index, byte stencil);
+
+	void BuildResolveTables(int width, int height);
+	const gml::color4* ResolveSourceRow(int row, gml::color4* scratch) const;
 
 	void PushScissorRect();
 	void PopScissorRect();
 
 	bool m_using_scissor = false;
+	RenderPipeline m_pipeline = RenderPipeline::Binned;
+	bool m_depth_prepass = false;
+	ThreadPool* m_pool;
 
 	int m_width;
 	int m_height;
+
+	//buffers hold m_buffer_pixels, padded to whole micro tiles in the tiled layout.
+	bool	m_tiled_layout = false;
+	int		m_micro_cols;
+	int		m_micro_rows;
+	int		m_buffer_pixels;
+
 	gml::color4 m_clear_color;
-	gml::color4* m_color_buffer;
+	ColorFormat m_color_format = ColorFormat::RGBA32F;
+	int		m_color_size;
+	byte*	m_color_buffer = nullptr;
 	byte	m_clear_stencil;
-	byte*	m_stencil_buffer;
+	byte*	m_stencil_buffer = nullptr;
 	float	m_clear_depth;
-	float*  m_depth_buffer;
+	float*  m_depth_buffer = nullptr;
+
+	//D24S8 keeps depth and stencil in here, the two buffers above are not allocated then.
+	DepthFormat m_depth_format = DepthFormat::D32F_S8;
+	unsigned int* m_depth_stencil_buffer = nullptr;
+
+	//hierarchical z, bounds of the depth buffer per 16x16 block in raster space.
+	bool	m_early_z = true;
+	int		m_hiz_cols;
+	int		m_hiz_rows;
+	float*	m_hiz_min;
+	float*	m_hiz_max;
+
+	//clear flags of the 32x32 screen tiles, in raster space.
+	int		m_tile_cols;
+	int		m_tile_rows;
+	byte*	m_tile_clears;
+
+	//resolve settings, and the buffer column and row of every output pixel for the last output size.
+	ResolveFilter m_resolve_filter = ResolveFilter::Point;
+	bool	m_resolve_srgb = false;
+	bool	m_resolve_dither = false;
+	int		m_resolve_width = 0;
+	int		m_resolve_height = 0;
+	std::vector<int> m_resolve_cols;
+	std::vector<int> m_resolve_rows;
+	std::vector<float> m_resolve_col_weights;	//bilinear weights of the next column and row
+	std::vector<float> m_resolve_row_weights;
 
 	gml::mat44 m_mat_world;
 	gml::mat44 m_mat_view;
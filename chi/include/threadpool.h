@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+//persistent worker threads, the renderer hands them one loop at a time.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int worker_count);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator = (const ThreadPool&) = delete;
+
+	//workers plus the calling thread.
+	int GetThreadCount() const { return static_cast<int>(m_workers.size()) + 1; }
+
+	//runs func(i) for every i in [0, count) and returns when all of them are done,
+	//the calling thread takes items too. calls must not be nested.
+	void ParallelFor(int count, const std::function<void(int)>& func);
+
+private:
+	void WorkerLoop();
+	void RunItems();
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	bool m_stop = false;
+
+	//current loop, open while m_func is set.
+	const std::function<void(int)>* m_func = nullptr;
+	int m_count = 0;
+	std::atomic<int> m_next;
+	int m_busy = 0;
+	unsigned int m_generation = 0;
+};
\ No newline at end of file
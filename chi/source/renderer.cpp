@@ -4,6 +4,10 @@
 #include <gmlmatrix.h>
 #include <gmlcolor.h>
 #include <vector>
+#include <string.h>
+#include <thread>
+#include <emmintrin.h>
+#include "threadpool.h"
 
 struct Fragment
 {
@@ -47,6 +51,30 @@ namespace
 		gml::vec2 texcoord;
 	};
 
+	//screen tiles, the fused pipeline works through a triangle one tile at a time
+	//and the binned pipeline hands whole tiles to the workers.
+	const int TILE_SIZE = 32;
+
+	//vertices snap to 1/16 pixel. the guard band keeps edge steps of a 4x4 block
+	//well inside 32 bits, triangles reaching beyond it use the float path.
+	const int SUBPIXEL_BITS = 4;
+	const int SUBPIXEL_SCALE = 1 << SUBPIXEL_BITS;
+	const float GUARD_BAND = 8192.0f;
+	const long long EDGE_CLAMP = 1 << 30;
+
+	//pending clears of a screen tile, applied when the tile is first drawn or at resolve.
+	enum ClearFlag
+	{
+		CLEAR_COLOR = 1,
+		CLEAR_DEPTH = 2,
+		CLEAR_STENCIL = 4,
+		CLEAR_ALL = CLEAR_COLOR | CLEAR_DEPTH | CLEAR_STENCIL,
+	};
+
+	//hierarchical z keeps depth bounds per 16x16 block, inside a single screen tile.
+	const int HIZ_SIZE = 16;
+	const float DEPTH_MARGIN = 1e-5f;
+
 	std::vector<V2F> inner_vertices;
 	std::vector<Fragment> fragments;
 	std::vector<Fragment> out_fragments;
@@ -63,6 +91,470 @@ namespace
 	}
 }
 
+//E(x, y) = a * x + b * y + c over subpixel coordinates, positive inside the triangle.
+struct EdgeFunction
+{
+	long long a;
+	long long b;
+	long long c;
+	int step_x;	//change from one pixel to the next
+	int step_y;
+};
+
+//per triangle constants shared by all of its pixels.
+struct TriangleSetup
+{
+	const V2F* pa;
+	const V2F* pb;
+	const V2F* pc;
+	float inv_wa;
+	float inv_wb;
+	float inv_wc;
+
+	//vertices inside the guard band use fixed point edge functions,
+	//the others keep the float barycentrics.
+	bool fixed_point;
+	EdgeFunction edges[3];	//edge k is opposite to vertex k
+	float inv_area;
+
+	//depth plane over raster pixels, and the depth range of the vertices.
+	float z0;
+	float dzdx;
+	float dzdy;
+	float zmin;
+	float zmax;
+
+	gml::vec2 a;
+	gml::vec2 ab;
+	gml::vec2 ac;
+	float inv_det;
+	int width;
+	int height;
+
+	//bounding box in raster space, y grows upwards.
+	int xmin;
+	int xmax;
+	int ymin;
+	int ymax;
+};
+
+namespace
+{
+	enum class Coverage
+	{
+		Outside,
+		Inside,
+		Partial,
+	};
+
+	//an edge function is linear, so its extremes over the pixels [x0, x1) x [y0, y1) lie on the corners.
+	Coverage ClassifyBlock(const TriangleSetup& setup, int x0, int y0, int x1, int y1)
+	{
+		bool inside = true;
+		for (int k = 0; k < 3; k++)
+		{
+			const EdgeFunction& edge = setup.edges[k];
+			long long e = edge.a * (x0 << SUBPIXEL_BITS) + edge.b * (y0 << SUBPIXEL_BITS) + edge.c;
+			long long dx = static_cast<long long>(x1 - 1 - x0) * edge.step_x;
+			long long dy = static_cast<long long>(y1 - 1 - y0) * edge.step_y;
+			long long emin = e + (dx < 0 ? dx : 0) + (dy < 0 ? dy : 0);
+			long long emax = e + (dx > 0 ? dx : 0) + (dy > 0 ? dy : 0);
+			if (emax < 0)
+			{
+				return Coverage::Outside;
+			}
+			if (emin < 0)
+			{
+				inside = false;
+			}
+		}
+		return inside ? Coverage::Inside : Coverage::Partial;
+	}
+
+	//linear to srgb, scaled to 0..255, indexed by the clamped value times SRGB_STEPS.
+	const int SRGB_STEPS = 4095;
+	struct SrgbTable
+	{
+		float values[SRGB_STEPS + 1];
+
+		SrgbTable()
+		{
+			for (int i = 0; i <= SRGB_STEPS; i++)
+			{
+				float c = i * 1.0f / SRGB_STEPS;
+				c = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+				values[i] = c * 255.0f;
+			}
+		}
+	};
+	const SrgbTable srgb_table;
+
+	//ordered dither, one offset of at most half a step per output pixel.
+	const float BAYER_4X4[4][4] =
+	{
+		{ 0.0f, 8.0f, 2.0f, 10.0f },
+		{ 12.0f, 4.0f, 14.0f, 6.0f },
+		{ 3.0f, 11.0f, 1.0f, 9.0f },
+		{ 15.0f, 7.0f, 13.0f, 5.0f },
+	};
+
+	//clamps, scales to 0..255 and rounds, bias holds the rounding half plus the dither of every 4th pixel.
+	//output is bgr like the dib section.
+	void ConvertPixels(const gml::color4* colors, int count, const float* bias, bool srgb, byte* dst)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 scale = _mm_set1_ps(srgb ? static_cast<float>(SRGB_STEPS) : 255.0f);
+		for (int i = 0; i < count; i++, dst += 3)
+		{
+			__m128 c = _mm_loadu_ps(&colors[i].r);
+			c = _mm_mul_ps(_mm_min_ps(_mm_max_ps(c, zero), one), scale);
+			if (srgb)
+			{
+				int steps[4];
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(steps), _mm_cvtps_epi32(c));
+				c = _mm_setr_ps(srgb_table.values[steps[0]], srgb_table.values[steps[1]], srgb_table.values[steps[2]], 0.0f);
+			}
+
+			__m128i v = _mm_cvttps_epi32(_mm_add_ps(c, _mm_set1_ps(bias[i & 3])));
+			v = _mm_packs_epi32(v, v);
+			v = _mm_packus_epi16(v, v);
+			unsigned int rgba = static_cast<unsigned int>(_mm_cvtsi128_si32(v));
+			dst[0] = (rgba >> 16) & 0xFF;
+			dst[1] = (rgba >> 8) & 0xFF;
+			dst[2] = rgba & 0xFF;
+		}
+	}
+
+	inline __m128 LerpColors(const gml::color4& a, const gml::color4& b, __m128 t)
+	{
+		__m128 va = _mm_loadu_ps(&a.r);
+		return _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&b.r), va), t));
+	}
+
+	//repeats the 4 words of value over count words, streaming stores bypass the cache
+	//when nothing reads the memory back soon.
+	void FillWords(unsigned int* dst, int count, __m128i value, bool stream)
+	{
+		int i = 0;
+		if (stream && (reinterpret_cast<size_t>(dst) & 15) == 0)
+		{
+			for (; i + 4 <= count; i += 4)
+			{
+				_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), value);
+			}
+		}
+		for (; i + 4 <= count; i += 4)
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), value);
+		}
+
+		unsigned int words[4];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(words), value);
+		for (; i < count; i++)
+		{
+			dst[i] = words[i & 3];
+		}
+	}
+
+	unsigned int ToUnorm(float value, float scale)
+	{
+		value = value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+		return static_cast<unsigned int>(value * scale + 0.5f);
+	}
+
+	//round to nearest, colors stay far from the half range so overflow just saturates.
+	unsigned short FloatToHalf(float value)
+	{
+		unsigned int bits;
+		memcpy(&bits, &value, sizeof(bits));
+		unsigned int sign = (bits >> 16) & 0x8000;
+		int exponent = static_cast<int>((bits >> 23) & 0xFF) - 127 + 15;
+		unsigned int mantissa = bits & 0x7FFFFF;
+		if (exponent >= 31)
+		{
+			return static_cast<unsigned short>(sign | 0x7C00);
+		}
+		if (exponent <= 0)
+		{
+			if (exponent < -10)
+			{
+				return static_cast<unsigned short>(sign);
+			}
+			mantissa |= 0x800000;
+			int shift = 14 - exponent;
+			return static_cast<unsigned short>(sign | ((mantissa + (1 << (shift - 1))) >> shift));
+		}
+		return static_cast<unsigned short>(sign | ((exponent << 10) + ((mantissa + 0x1000) >> 13)));
+	}
+
+	float HalfToFloat(unsigned short half)
+	{
+		unsigned int sign = (half & 0x8000) << 16;
+		unsigned int exponent = (half >> 10) & 0x1F;
+		unsigned int mantissa = half & 0x3FF;
+		if (exponent == 0)
+		{
+			float value = mantissa * (1.0f / 16777216.0f);
+			return sign ? -value : value;
+		}
+
+		unsigned int bits = sign | (exponent == 31 ? 0x7F800000 : (exponent + 112) << 23) | (mantissa << 13);
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	int GetColorSize(ColorFormat format)
+	{
+		switch (format)
+		{
+		case ColorFormat::RGBA16F:
+			return 8;
+		case ColorFormat::RGB10A2:
+		case ColorFormat::RGBA8:
+			return 4;
+		default:
+			return sizeof(gml::color4);
+		}
+	}
+
+	void EncodeColor(ColorFormat format, const gml::color4& color, byte* dst)
+	{
+		switch (format)
+		{
+		case ColorFormat::RGBA16F:
+		{
+			unsigned short halfs[4] = { FloatToHalf(color.r), FloatToHalf(color.g), FloatToHalf(color.b), FloatToHalf(color.a) };
+			memcpy(dst, halfs, sizeof(halfs));
+			break;
+		}
+		case ColorFormat::RGB10A2:
+		{
+			unsigned int word = ToUnorm(color.r, 1023.0f) | (ToUnorm(color.g, 1023.0f) << 10) | (ToUnorm(color.b, 1023.0f) << 20) | (ToUnorm(color.a, 3.0f) << 30);
+			memcpy(dst, &word, sizeof(word));
+			break;
+		}
+		case ColorFormat::RGBA8:
+		{
+			unsigned int word = ToUnorm(color.r, 255.0f) | (ToUnorm(color.g, 255.0f) << 8) | (ToUnorm(color.b, 255.0f) << 16) | (ToUnorm(color.a, 255.0f) << 24);
+			memcpy(dst, &word, sizeof(word));
+			break;
+		}
+		default:
+			memcpy(dst, &color, sizeof(color));
+			break;
+		}
+	}
+
+	gml::color4 DecodeColor(ColorFormat format, const byte* src)
+	{
+		gml::color4 color;
+		switch (format)
+		{
+		case ColorFormat::RGBA16F:
+		{
+			unsigned short halfs[4];
+			memcpy(halfs, src, sizeof(halfs));
+			color = gml::color4(HalfToFloat(halfs[0]), HalfToFloat(halfs[1]), HalfToFloat(halfs[2]), HalfToFloat(halfs[3]));
+			break;
+		}
+		case ColorFormat::RGB10A2:
+		{
+			unsigned int word;
+			memcpy(&word, src, sizeof(word));
+			color = gml::color4((word & 0x3FF) / 1023.0f, ((word >> 10) & 0x3FF) / 1023.0f, ((word >> 20) & 0x3FF) / 1023.0f, (word >> 30) / 3.0f);
+			break;
+		}
+		case ColorFormat::RGBA8:
+		{
+			unsigned int word;
+			memcpy(&word, src, sizeof(word));
+			color = gml::color4((word & 0xFF) / 255.0f, ((word >> 8) & 0xFF) / 255.0f, ((word >> 16) & 0xFF) / 255.0f, (word >> 24) / 255.0f);
+			break;
+		}
+		default:
+			memcpy(&color, src, sizeof(color));
+			break;
+		}
+		return color;
+	}
+
+	//24 bit unorm depth in the high bits, stencil in the low byte.
+	unsigned int EncodeDepth(float z)
+	{
+		//a float cannot add the rounding half near 2^24 without carrying into bit 24.
+		double value = z > 0.0f ? (z < 1.0f ? z : 1.0f) : 0.0f;
+		return static_cast<unsigned int>(value * 16777215.0 + 0.5);
+	}
+
+	float DecodeDepth(unsigned int word)
+	{
+		return (word >> 8) * (1.0f / 16777215.0f);
+	}
+
+	//conservative depth range of the triangle over the pixels [x0, x1) x [y0, y1).
+	void BlockDepthRange(const TriangleSetup& setup, int x0, int y0, int x1, int y1, float& zmin, float& zmax)
+	{
+		zmin = setup.zmin;
+		zmax = setup.zmax;
+		if (setup.fixed_point)
+		{
+			float z = setup.z0 + x0 * setup.dzdx + y0 * setup.dzdy;
+			float dx = (x1 - 1 - x0) * setup.dzdx;
+			float dy = (y1 - 1 - y0) * setup.dzdy;
+			float lower = z + (dx < 0.0f ? dx : 0.0f) + (dy < 0.0f ? dy : 0.0f) - DEPTH_MARGIN;
+			float upper = z + (dx > 0.0f ? dx : 0.0f) + (dy > 0.0f ? dy : 0.0f) + DEPTH_MARGIN;
+			zmin = lower > zmin ? lower : zmin;
+			zmax = upper < zmax ? upper : zmax;
+		}
+	}
+
+	//shared by the depth pre-pass and InterpolateFragment, so the shade pass can compare for equality.
+	inline float InterpolateDepth(const TriangleSetup& setup, float u, float v)
+	{
+		float w = 1.0f - u - v;
+		return setup.pa->sv_position.z * w +
+			setup.pb->sv_position.z * u +
+			setup.pc->sv_position.z * v;
+	}
+
+	//lanes of the 4x4 block at (bx, by) that fall into [x0, x1) x [y0, y1), bit j * 4 + i for pixel (i, j).
+	int BlockBounds(int bx, int by, int x0, int y0, int x1, int y1)
+	{
+		int cols = 0xF;
+		if (bx < x0) cols &= 0xF << (x0 - bx);
+		if (bx + 4 > x1) cols &= 0xF >> (bx + 4 - x1);
+
+		int mask = 0;
+		for (int j = 0; j < 4; j++)
+		{
+			if (by + j >= y0 && by + j < y1)
+			{
+				mask |= cols << (j * 4);
+			}
+		}
+		return mask;
+	}
+
+	std::vector<TriangleSetup> triangle_setups;
+	std::vector<std::vector<int>> tile_bins;
+
+	//calls func(x, y, u, v) for every covered pixel of [x0, x1) x [y0, y1),
+	//u and v are the screen space weights of vertex b and c.
+	template<typename Func>
+	void ForEachPixel(const TriangleSetup& setup, int x0, int y0, int x1, int y1, Func func)
+	{
+		if (!setup.fixed_point)
+		{
+			for (int y = y0; y < y1; y++)
+			{
+				for (int x = x0; x < x1; x++)
+				{
+					//uv
+					gml::vec2 ta = gml::vec2(x*2.0f / setup.width - 1.0f, y * 2.0f / setup.height - 1.0f) - setup.a;
+					float u = gml::det22_t(ta, setup.ac) * setup.inv_det;
+					float v = gml::det22_t(setup.ab, ta) * setup.inv_det;
+					if (u <0.0f || v < 0.0f || u > 1.0f || u + v >1.0f)
+					{
+						continue;
+					}
+					func(x, y, u, v);
+				}
+			}
+			return;
+		}
+
+		__m128i lane_x[3];
+		__m128i step_y[3];
+		for (int k = 0; k < 3; k++)
+		{
+			int s = setup.edges[k].step_x;
+			lane_x[k] = _mm_setr_epi32(0, s, s * 2, s * 3);
+			step_y[k] = _mm_set1_epi32(setup.edges[k].step_y);
+		}
+
+		//16x16 blocks first, then the 4x4 blocks inside the partial ones. blocks on the screen
+		//grid are rejected or accepted as a whole, only partial 4x4 blocks test single pixels.
+		for (int cy = y0 & ~15; cy < y1; cy += 16)
+		{
+			int cy0 = cy > y0 ? cy : y0;
+			int cy1 = cy + 16 < y1 ? cy + 16 : y1;
+			for (int cx = x0 & ~15; cx < x1; cx += 16)
+			{
+				int cx0 = cx > x0 ? cx : x0;
+				int cx1 = cx + 16 < x1 ? cx + 16 : x1;
+				Coverage coarse = ClassifyBlock(setup, cx0, cy0, cx1, cy1);
+				if (coarse == Coverage::Outside)
+				{
+					continue;
+				}
+
+				for (int by = cy0 & ~3; by < cy1; by += 4)
+				{
+					int fy0 = by > cy0 ? by : cy0;
+					int fy1 = by + 4 < cy1 ? by + 4 : cy1;
+					for (int bx = cx0 & ~3; bx < cx1; bx += 4)
+					{
+						int fx0 = bx > cx0 ? bx : cx0;
+						int fx1 = bx + 4 < cx1 ? bx + 4 : cx1;
+						Coverage fine = coarse == Coverage::Inside ? Coverage::Inside : ClassifyBlock(setup, fx0, fy0, fx1, fy1);
+						if (fine == Coverage::Outside)
+						{
+							continue;
+						}
+
+						long long origin[3];
+						for (int k = 0; k < 3; k++)
+						{
+							const EdgeFunction& edge = setup.edges[k];
+							origin[k] = edge.a * (bx << SUBPIXEL_BITS) + edge.b * (by << SUBPIXEL_BITS) + edge.c;
+						}
+
+						int mask = BlockBounds(bx, by, fx0, fy0, fx1, fy1);
+						if (fine == Coverage::Partial)
+						{
+							__m128i e[3];
+							for (int k = 0; k < 3; k++)
+							{
+								//far from the edge the whole block shares one sign, clamping keeps the lanes in 32 bits.
+								long long clamped = origin[k] > EDGE_CLAMP ? EDGE_CLAMP : (origin[k] < -EDGE_CLAMP ? -EDGE_CLAMP : origin[k]);
+								e[k] = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(clamped)), lane_x[k]);
+							}
+
+							//a lane is covered when no edge is negative.
+							int covered = 0;
+							for (int j = 0; j < 4; j++)
+							{
+								__m128i any = _mm_or_si128(_mm_or_si128(e[0], e[1]), e[2]);
+								covered |= (~_mm_movemask_ps(_mm_castsi128_ps(any)) & 0xF) << (j * 4);
+								for (int k = 0; k < 3; k++)
+								{
+									e[k] = _mm_add_epi32(e[k], step_y[k]);
+								}
+							}
+							mask &= covered;
+						}
+
+						for (int bit = 0; bit < 16; bit++)
+						{
+							if ((mask & (1 << bit)) == 0)
+							{
+								continue;
+							}
+
+							int i = bit & 3;
+							int j = bit >> 2;
+							long long eb = origin[1] + i * setup.edges[1].step_x + j * setup.edges[1].step_y;
+							long long ec = origin[2] + i * setup.edges[2].step_x + j * setup.edges[2].step_y;
+							func(bx + i, by + j, eb * setup.inv_area, ec * setup.inv_area);
+						}
+					}
+				}
+			}
+		}
+	}
+}
 
 
 Renderer::Renderer(int width, int height)
@@ -70,9 +562,23 @@ Renderer::Renderer(int width, int height)
 	m_width = width;
 	m_height = height;
 
-	m_color_buffer = new gml::color4[width * height];
-	m_depth_buffer = new float[width * height];
-	m_stencil_buffer = new byte[width * height];
+	m_micro_cols = (width + 7) / 8;
+	m_micro_rows = (height + 7) / 8;
+	m_buffer_pixels = width * height;
+	CreateColorBuffer();
+	CreateDepthBuffer();
+
+	m_hiz_cols = (width + HIZ_SIZE - 1) / HIZ_SIZE;
+	m_hiz_rows = (height + HIZ_SIZE - 1) / HIZ_SIZE;
+	m_hiz_min = new float[m_hiz_cols * m_hiz_rows];
+	m_hiz_max = new float[m_hiz_cols * m_hiz_rows];
+
+	m_tile_cols = (width + TILE_SIZE - 1) / TILE_SIZE;
+	m_tile_rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+	m_tile_clears = new byte[m_tile_cols * m_tile_rows];
+
+	int cores = static_cast<int>(std::thread::hardware_concurrency());
+	m_pool = new ThreadPool(cores > 1 ? cores - 1 : 0);
 
 	m_vertex_count = sizeof(vertices) / sizeof(Vertex);
 	m_triangle_count = sizeof(indices) / sizeof(Index) / 3;
@@ -109,12 +615,19 @@ Renderer::Renderer(int width, int height)
 	m_clear_color = gml::color4::black();
 	m_clear_depth = 1.0f;
 	m_clear_stencil = 0;
+	ClearBuffer();
 }
 
 Renderer::~Renderer()
 {
 	delete[] m_color_buffer;
 	delete[] m_depth_buffer;
+	delete[] m_stencil_buffer;
+	delete[] m_depth_stencil_buffer;
+	delete[] m_hiz_min;
+	delete[] m_hiz_max;
+	delete[] m_tile_clears;
+	delete m_pool;
 }
 
 void Renderer::Render()
@@ -135,27 +648,255 @@ void Renderer::Render()
 	if (m_using_scissor) PushScissorRect();
 	ClearBuffer();
 	VertexShader();
-	Rasterization();
-	PixelShader();
-	OutputMerge();
+	if (m_pipeline == RenderPipeline::Staged)
+	{
+		//fragments are merged all over the frame, so the clear cannot wait for the tiles.
+		ClearPendingTiles();
+		Rasterization();
+		PixelShader();
+		OutputMerge();
+	}
+	else if (m_pipeline == RenderPipeline::Fused)
+	{
+		FusedPipeline();
+	}
+	else
+	{
+		BinnedPipeline();
+	}
 	if (m_using_scissor) PopScissorRect();
 }
 
 void Renderer::ClearBuffer()
 {
-	for (int h = 0; h < m_height; h++)
+	//only flags the tiles, their pixels are written when something draws there or at resolve.
+	for (int i = 0; i < m_tile_cols * m_tile_rows; i++)
+	{
+		m_tile_clears[i] = CLEAR_ALL;
+	}
+
+	for (int i = 0; i < m_hiz_cols * m_hiz_rows; i++)
+	{
+		m_hiz_min[i] = m_clear_depth;
+		m_hiz_max[i] = m_clear_depth;
+	}
+
+	fragments.clear();
+}
+
+void Renderer::SetTiledLayout(bool enabled)
+{
+	m_tiled_layout = enabled;
+	m_buffer_pixels = enabled ? m_micro_cols * m_micro_rows * 64 : m_width * m_height;
+	CreateColorBuffer();
+	CreateDepthBuffer();
+	for (int i = 0; i < m_tile_cols * m_tile_rows; i++)
+	{
+		m_tile_clears[i] = CLEAR_ALL;
+	}
+}
+
+int Renderer::PixelIndex(int x, int row) const
+{
+	if (m_tiled_layout)
 	{
-		for (int w = 0; w < m_width; w++)
+		//8x8 micro tiles in raster order, each one stored row by row.
+		int y = m_height - row - 1;
+		return (((y >> 3) * m_micro_cols + (x >> 3)) << 6) + ((y & 7) << 3) + (x & 7);
+	}
+	return row * m_width + x;
+}
+
+void Renderer::CreateColorBuffer()
+{
+	delete[] m_color_buffer;
+	m_color_size = GetColorSize(m_color_format);
+	m_color_buffer = new byte[m_buffer_pixels * m_color_size];
+}
+
+void Renderer::CreateDepthBuffer()
+{
+	delete[] m_depth_buffer;
+	delete[] m_stencil_buffer;
+	delete[] m_depth_stencil_buffer;
+	m_depth_buffer = nullptr;
+	m_stencil_buffer = nullptr;
+	m_depth_stencil_buffer = nullptr;
+	if (m_depth_format == DepthFormat::D24S8)
+	{
+		m_depth_stencil_buffer = new unsigned int[m_buffer_pixels];
+	}
+	else
+	{
+		m_depth_buffer = new float[m_buffer_pixels];
+		m_stencil_buffer = new byte[m_buffer_pixels];
+	}
+}
+
+void Renderer::SetColorFormat(ColorFormat format)
+{
+	m_color_format = format;
+	CreateColorBuffer();
+	for (int i = 0; i < m_tile_cols * m_tile_rows; i++)
+	{
+		m_tile_clears[i] |= CLEAR_COLOR;
+	}
+}
+
+void Renderer::SetDepthFormat(DepthFormat format)
+{
+	m_depth_format = format;
+	CreateDepthBuffer();
+	for (int i = 0; i < m_tile_cols * m_tile_rows; i++)
+	{
+		m_tile_clears[i] |= CLEAR_DEPTH | CLEAR_STENCIL;
+	}
+}
+
+gml::color4 Renderer::LoadColor(int index) const
+{
+	return DecodeColor(m_color_format, m_color_buffer + index * m_color_size);
+}
+
+void Renderer::StoreColor(int index, const gml::color4& color)
+{
+	EncodeColor(m_color_format, color, m_color_buffer + index * m_color_size);
+}
+
+float Renderer::LoadDepth(int index) const
+{
+	return m_depth_stencil_buffer ? DecodeDepth(m_depth_stencil_buffer[index]) : m_depth_buffer[index];
+}
+
+void Renderer::StoreDepth(int index, float z)
+{
+	if (m_depth_stencil_buffer)
+	{
+		m_depth_stencil_buffer[index] = (EncodeDepth(z) << 8) | (m_depth_stencil_buffer[index] & 0xFF);
+	}
+	else
+	{
+		m_depth_buffer[index] = z;
+	}
+}
+
+bool Renderer::DepthEqual(int index, float z) const
+{
+	//packed depth compares in its own precision, the pre-pass stored it rounded.
+	if (m_depth_stencil_buffer)
+	{
+		return EncodeDepth(z) == (m_depth_stencil_buffer[index] >> 8);
+	}
+	return z == m_depth_buffer[index];
+}
+
+byte Renderer::LoadStencil(int index) const
+{
+	return m_depth_stencil_buffer ? static_cast<byte>(m_depth_stencil_buffer[index]) : m_stencil_buffer[index];
+}
+
+void Renderer::StoreStencil(int index, byte stencil)
+{
+	if (m_depth_stencil_buffer)
+	{
+		m_depth_stencil_buffer[index] = (m_depth_stencil_buffer[index] & 0xFFFFFF00) | stencil;
+	}
+	else
+	{
+		m_stencil_buffer[index] = stencil;
+	}
+}
+
+gml::color4 Renderer::ClearColor(int row) const
+{
+	gml::color4 color = m_clear_color;
+	color.r = row * 0.2f / m_height;
+	return color;
+}
+
+void Renderer::ClearTile(int tile, bool stream)
+{
+	byte flags = m_tile_clears[tile];
+	if (flags == 0)
+	{
+		return;
+	}
+	m_tile_clears[tile] = 0;
+
+	int x0 = (tile % m_tile_cols) * TILE_SIZE;
+	int y0 = (tile / m_tile_cols) * TILE_SIZE;
+	int x1 = x0 + TILE_SIZE < m_width ? x0 + TILE_SIZE : m_width;
+	int y1 = y0 + TILE_SIZE < m_height ? y0 + TILE_SIZE : m_height;
+
+	//a tile row is one run of pixels, or one per micro tile including its padding.
+	int count = m_tiled_layout ? 8 : x1 - x0;
+	for (int y = y0; y < y1; y++)
+	{
+		//tiles are in raster space, the buffers start at the top row.
+		int row = m_height - y - 1;
+
+		//16 bytes hold whole pixels of every format.
+		byte pattern[16];
+		EncodeColor(m_color_format, ClearColor(row), pattern);
+		for (int i = m_color_size; i < 16; i += m_color_size)
+		{
+			memcpy(pattern + i, pattern, m_color_size);
+		}
+
+		for (int x = x0; x < x1; x += count)
 		{
-			int index = h * m_width + w;
-			m_clear_color.r = h * 0.2f / m_height;
-			m_color_buffer[index] = m_clear_color;
-			m_depth_buffer[index] = m_clear_depth;
-			m_stencil_buffer[index] = m_clear_stencil;
+			int index = PixelIndex(x, row);
+			if (flags & CLEAR_COLOR)
+			{
+				FillWords(reinterpret_cast<unsigned int*>(m_color_buffer + index * m_color_size), count * m_color_size / 4,
+					_mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern)), stream);
+			}
+
+			if (m_depth_stencil_buffer == nullptr)
+			{
+				if (flags & CLEAR_DEPTH)
+				{
+					FillWords(reinterpret_cast<unsigned int*>(m_depth_buffer + index), count, _mm_castps_si128(_mm_set1_ps(m_clear_depth)), stream);
+				}
+				if (flags & CLEAR_STENCIL)
+				{
+					memset(m_stencil_buffer + index, m_clear_stencil, count);
+				}
+			}
+			else if ((flags & CLEAR_DEPTH) && (flags & CLEAR_STENCIL))
+			{
+				unsigned int word = (EncodeDepth(m_clear_depth) << 8) | m_clear_stencil;
+				FillWords(m_depth_stencil_buffer + index, count, _mm_set1_epi32(static_cast<int>(word)), stream);
+			}
+			else
+			{
+				for (int i = index; i < index + count; i++)
+				{
+					if (flags & CLEAR_DEPTH)
+					{
+						StoreDepth(i, m_clear_depth);
+					}
+					if (flags & CLEAR_STENCIL)
+					{
+						StoreStencil(i, m_clear_stencil);
+					}
+				}
+			}
 		}
 	}
 
-	fragments.clear();
+	if (stream)
+	{
+		_mm_sfence();
+	}
+}
+
+void Renderer::ClearPendingTiles()
+{
+	m_pool->ParallelFor(m_tile_cols * m_tile_rows, [&](int tile)
+	{
+		ClearTile(tile, true);
+	});
 }
 void Renderer::VertexShader()
 {
@@ -175,87 +916,255 @@ void Renderer::VertexShader()
 	}
 }
 
-void Renderer::Rasterization()
+bool Renderer::SetupTriangle(int triangle, TriangleSetup& setup) const
 {
-	for (int triangle = 0; triangle < m_triangle_count; triangle++)
+	Index& ia = indices[triangle * 3 + 0];
+	Index& ib = indices[triangle * 3 + 1];
+	Index& ic = indices[triangle * 3 + 2];
+	V2F& pa = inner_vertices[ia];
+	V2F& pb = inner_vertices[ib];
+	V2F& pc = inner_vertices[ic];
+
+	setup.pa = &pa;
+	setup.pb = &pb;
+	setup.pc = &pc;
+	setup.inv_wa = 1.0f / pa.sv_position.w;
+	setup.inv_wb = 1.0f / pb.sv_position.w;
+	setup.inv_wc = 1.0f / pc.sv_position.w;
+	setup.width = m_width;
+	setup.height = m_height;
+
+	float za = pa.sv_position.z;
+	float zb = pb.sv_position.z;
+	float zc = pc.sv_position.z;
+	setup.zmin = (za < zb ? (za < zc ? za : zc) : (zb < zc ? zb : zc)) - DEPTH_MARGIN;
+	setup.zmax = (za > zb ? (za > zc ? za : zc) : (zb > zc ? zb : zc)) + DEPTH_MARGIN;
+
+	//snap to the subpixel grid, pixel x samples at x * SUBPIXEL_SCALE.
+	const V2F* points[3] = { &pa, &pb, &pc };
+	long long fx[3], fy[3];
+	setup.fixed_point = true;
+	for (int k = 0; k < 3; k++)
+	{
+		float x = (points[k]->sv_position.x * 0.5f + 0.5f) * m_width;
+		float y = (points[k]->sv_position.y * 0.5f + 0.5f) * m_height;
+		if (!(points[k]->sv_position.w > 0.0f && x > -GUARD_BAND && x < GUARD_BAND && y > -GUARD_BAND && y < GUARD_BAND))
+		{
+			setup.fixed_point = false;
+			break;
+		}
+		fx[k] = static_cast<long long>(floorf(x * SUBPIXEL_SCALE + 0.5f));
+		fy[k] = static_cast<long long>(floorf(y * SUBPIXEL_SCALE + 0.5f));
+	}
+
+	if (setup.fixed_point)
 	{
-		Index& ia = indices[triangle * 3 + 0];
-		Index& ib = indices[triangle * 3 + 1];
-		Index& ic = indices[triangle * 3 + 2];
-		V2F& pa = inner_vertices[ia];
-		V2F& pb = inner_vertices[ib];
-		V2F& pc = inner_vertices[ic];
+		long long area = (fx[1] - fx[0]) * (fy[2] - fy[0]) - (fy[1] - fy[0]) * (fx[2] - fx[0]);
+		if (area == 0)
+		{
+			return false;
+		}
+
+		//duel-face, both windings are turned into positive edge functions.
+		long long sign = area > 0 ? 1 : -1;
+		for (int k = 0; k < 3; k++)
+		{
+			int v0 = (k + 1) % 3;
+			int v1 = (k + 2) % 3;
+			EdgeFunction& edge = setup.edges[k];
+			edge.a = (fy[v0] - fy[v1]) * sign;
+			edge.b = (fx[v1] - fx[v0]) * sign;
+			edge.c = -edge.a * fx[v0] - edge.b * fy[v0];
+
+			//top-left rule, pixels on a shared edge belong to one triangle only.
+			bool top_left = edge.a > 0 || (edge.a == 0 && edge.b < 0);
+			if (!top_left)
+			{
+				edge.c -= 1;
+			}
+
+			edge.step_x = static_cast<int>(edge.a * SUBPIXEL_SCALE);
+			edge.step_y = static_cast<int>(edge.b * SUBPIXEL_SCALE);
+		}
+		setup.inv_area = 1.0f / static_cast<float>(area * sign);
+
+		//z is linear in screen space, the plane passes through vertex a.
+		double dzb = pb.sv_position.z - pa.sv_position.z;
+		double dzc = pc.sv_position.z - pa.sv_position.z;
+		double inv_area = 1.0 / static_cast<double>(area * sign);
+		double dzdx = (dzb * setup.edges[1].step_x + dzc * setup.edges[2].step_x) * inv_area;
+		double dzdy = (dzb * setup.edges[1].step_y + dzc * setup.edges[2].step_y) * inv_area;
+		setup.z0 = static_cast<float>(pa.sv_position.z - (dzdx * fx[0] + dzdy * fy[0]) / SUBPIXEL_SCALE);
+		setup.dzdx = static_cast<float>(dzdx);
+		setup.dzdy = static_cast<float>(dzdy);
 
+		long long xmin = fx[0] < fx[1] ? (fx[0] < fx[2] ? fx[0] : fx[2]) : (fx[1] < fx[2] ? fx[1] : fx[2]);
+		long long xmax = fx[0] > fx[1] ? (fx[0] > fx[2] ? fx[0] : fx[2]) : (fx[1] > fx[2] ? fx[1] : fx[2]);
+		long long ymin = fy[0] < fy[1] ? (fy[0] < fy[2] ? fy[0] : fy[2]) : (fy[1] < fy[2] ? fy[1] : fy[2]);
+		long long ymax = fy[0] > fy[1] ? (fy[0] > fy[2] ? fy[0] : fy[2]) : (fy[1] > fy[2] ? fy[1] : fy[2]);
+		setup.xmin = static_cast<int>((xmin + SUBPIXEL_SCALE - 1) >> SUBPIXEL_BITS);
+		setup.xmax = static_cast<int>(xmax >> SUBPIXEL_BITS) + 1;
+		setup.ymin = static_cast<int>((ymin + SUBPIXEL_SCALE - 1) >> SUBPIXEL_BITS);
+		setup.ymax = static_cast<int>(ymax >> SUBPIXEL_BITS) + 1;
+	}
+	else
+	{
 		gml::vec2 min = gml::min_combine(gml::vec2(pa.sv_position), gml::vec2(pb.sv_position));
 		min = gml::min_combine(min, gml::vec2(pc.sv_position));
 
 		gml::vec2 max = gml::max_combine(gml::vec2(pa.sv_position), gml::vec2(pb.sv_position));
 		max = gml::max_combine(max, gml::vec2(pc.sv_position));
 
-		int xmini = static_cast<int>((min.x * 0.5f + 0.5f) * m_width);
-		int xmaxi = static_cast<int>((max.x * 0.5f + 0.5f) * m_width) + 1;
-		int ymini = static_cast<int>((min.y * 0.5f + 0.5f) * m_height);
-		int ymaxi = static_cast<int>((max.y * 0.5f + 0.5f) * m_height) + 1;
-		if (xmini < 0) xmini = 0;
-		if (ymini < 0) ymini = 0;
-		if (xmaxi > m_width)xmaxi = m_width;
-		if (ymaxi > m_height)ymaxi = m_height;
-
-		gml::vec2 a = gml::vec2(pa.sv_position);
-		gml::vec2 ab = gml::vec2(pb.sv_position) - a;
-		gml::vec2 ac = gml::vec2(pc.sv_position) - a;
-		float det = gml::det22_t(ab, ac);
+		setup.xmin = static_cast<int>((min.x * 0.5f + 0.5f) * m_width);
+		setup.xmax = static_cast<int>((max.x * 0.5f + 0.5f) * m_width) + 1;
+		setup.ymin = static_cast<int>((min.y * 0.5f + 0.5f) * m_height);
+		setup.ymax = static_cast<int>((max.y * 0.5f + 0.5f) * m_height) + 1;
+
+		setup.a = gml::vec2(pa.sv_position);
+		setup.ab = gml::vec2(pb.sv_position) - setup.a;
+		setup.ac = gml::vec2(pc.sv_position) - setup.a;
+		float det = gml::det22_t(setup.ab, setup.ac);
 		if (gml::fequal(det, 0.0f))
 		{
-			continue;
+			return false;
 		}
+		setup.inv_det = 1.0f / det;
+	}
+
+	if (setup.xmin < 0) setup.xmin = 0;
+	if (setup.ymin < 0) setup.ymin = 0;
+	if (setup.xmax > m_width) setup.xmax = m_width;
+	if (setup.ymax > m_height) setup.ymax = m_height;
+	return true;
+}
+
+void Renderer::InterpolateFragment(const TriangleSetup& setup, int x, int y, float u, float v, Fragment& f) const
+{
+	const V2F& pa = *setup.pa;
+	const V2F& pb = *setup.pb;
+	const V2F& pc = *setup.pc;
+
+	//bufferyҪע
+	f.x = x;
+	f.y = m_height - y - 1;
+
+	float w = 1.0f - u - v;
+	f.z = InterpolateDepth(setup, u, v);
+
+	f.color = pa.color * w +
+		pb.color * u +
+		pc.color * v;
 
-		//duel-face.
-		float inv_det = 1.0f / det;
-		//float inv_det = det < 0 ? 1.0f / det : -1.0f / det;
+	//͸
+	f.uv = pa.texcoord * w * setup.inv_wa +
+		pb.texcoord * u * setup.inv_wb +
+		pc.texcoord * v * setup.inv_wc;
 
-		for (int y = ymini; y < ymaxi; y++)
+	//иõİ취vertex out˵
+	float inv_w = setup.inv_wa * w + setup.inv_wb * u + setup.inv_wc * v;
+	f.uv *= 1.0f / inv_w;
+}
+
+void Renderer::ShadeFragment(const Fragment& f, Fragment& of) const
+{
+	of.x = f.x;
+	of.y = f.y;
+	of.z = f.z;
+	gml::color4 sample = SampleGridTexture(f.uv);
+	of.color = f.color.clamped() * sample;
+	of.color.clamp();
+}
+
+bool Renderer::ScissorTest(int x, int y) const
+{
+	if (m_scissor_rects.size() == 0)
+	{
+		return true;
+	}
+
+	for (auto& r : m_scissor_rects)
+	{
+		if (r.contains(x, y))
 		{
-			for (int x = xmini; x < xmaxi; x++)
-			{
-				//uv
-				gml::vec2 ta = gml::vec2(x*2.0f / m_width - 1.0f, y * 2.0f / m_height - 1.0f) - a;
-				float u = gml::det22_t(ta, ac) * inv_det;
-				float v = gml::det22_t(ab, ta) * inv_det;
-				if (u <0.0f || v < 0.0f || u > 1.0f || u + v >1.0f)
-				{
-					continue;
-				}
-				//bufferyҪע
-				int index = fragments.size();
-				fragments.resize(index + 1);
-				Fragment& f = fragments[index];
-				f.x = x;
-				f.y = m_height - y - 1;
-
-				float w = 1.0f - u - v;
-				f.z = pa.sv_position.z * w +
-					pb.sv_position.z * u +
-					pc.sv_position.z * v;
-
-				f.color = pa.color * w +
-					pb.color * u +
-					pc.color * v;
-
-				//͸
-				float inv_wa = 1.0f / pa.sv_position.w;
-				float inv_wb = 1.0f / pb.sv_position.w;
-				float inv_wc = 1.0f / pc.sv_position.w;
-				f.uv = pa.texcoord * w * inv_wa +
-					pb.texcoord * u * inv_wb +
-					pc.texcoord * v * inv_wc;
-
-				//иõİ취vertex out˵
-				float inv_w = inv_wa * w + inv_wb * u + inv_wc * v;
-				f.uv *= 1.0f / inv_w;
-			}
+			return true;
 		}
 	}
+	return false;
+}
+
+void Renderer::MergeFragment(const Fragment& f, bool depth_equal)
+{
+	int index = PixelIndex(f.x, f.y);
+
+	//alpha-test
+	if (f.color.a < 0.001f)
+	{
+		return; ///discard;
+	}
+
+	//scissor-test
+	if (!ScissorTest(f.x, f.y))
+	{
+		return;
+	}
+
+	//stencil-test
+	if (f.stencil >= 0)
+	{
+		if (f.stencil > LoadStencil(index))
+		{
+			StoreStencil(index, f.stencil);
+		}
+		else
+		{
+			return; ///discard;
+		}
+	}
+
+	// z-test, after the pre-pass the depth is already written
+	if (depth_equal)
+	{
+		if (!DepthEqual(index, f.z))
+		{
+			return; ///discard;
+		}
+	}
+	else if (f.z >= 0.0f && f.z < LoadDepth(index))
+	{
+		StoreDepth(index, f.z);
+	}
+	else
+	{
+		return; ///discard;
+	}
+
+	// blending, in float whatever the render target stores
+	gml::color4 dst = LoadColor(index);
+	auto& src = f.color;
+	dst.replace(gml::lerp(
+		gml::swizzle<gml::_R, gml::_G, gml::_B>(dst),
+		gml::swizzle<gml::_R, gml::_G, gml::_B>(src),
+		src.a));
+	StoreColor(index, dst);
+}
+
+void Renderer::Rasterization()
+{
+	for (int triangle = 0; triangle < m_triangle_count; triangle++)
+	{
+		TriangleSetup setup;
+		if (!SetupTriangle(triangle, setup))
+		{
+			continue;
+		}
+
+		Fragment f;
+		ForEachPixel(setup, setup.xmin, setup.ymin, setup.xmax, setup.ymax, [&](int x, int y, float u, float v)
+		{
+			InterpolateFragment(setup, x, y, u, v, f);
+			fragments.push_back(f);
+		});
+	}
 }
 
 void Renderer::PixelShader()
@@ -264,101 +1173,415 @@ void Renderer::PixelShader()
 	out_fragments.resize(fragment_count);
 	for (int i = 0; i < fragment_count; i++)
 	{
-		Fragment& f = fragments[i];
-		Fragment& of = out_fragments[i];
-
-		of.x = f.x;
-		of.y = f.y;
-		of.z = f.z;
-		gml::color4 sample = SampleGridTexture(f.uv);
-		of.color = f.color.clamped() * sample;
-		of.color.clamp();
+		ShadeFragment(fragments[i], out_fragments[i]);
 	}
 }
+
 void Renderer::OutputMerge()
 {
 	int fragment_count = out_fragments.size();
 	for (int i = 0; i < fragment_count; i++)
 	{
-		Fragment& f = out_fragments[i];
-		int index = f.y * m_width + f.x;
+		MergeFragment(out_fragments[i]);
+	}
+}
 
-		//alpha-test
-		if (f.color.a < 0.001f)
+void Renderer::DrawPixels(const TriangleSetup& setup, int x0, int y0, int x1, int y1, DrawPass pass)
+{
+	if (!m_early_z && pass == DrawPass::Color)
+	{
+		ForEachPixel(setup, x0, y0, x1, y1, [&](int x, int y, float u, float v)
 		{
-			continue; ///discard;
-		}
+			Fragment f, of;
+			InterpolateFragment(setup, x, y, u, v, f);
+			ShadeFragment(f, of);
+			MergeFragment(of);
+		});
+		return;
+	}
 
-		//scissor-test
-		if (m_scissor_rects.size() != 0)
+	//hierarchical z works on the 16x16 blocks the traversal starts from.
+	for (int cy = y0 & ~(HIZ_SIZE - 1); cy < y1; cy += HIZ_SIZE)
+	{
+		int by0 = cy > y0 ? cy : y0;
+		int by1 = cy + HIZ_SIZE < y1 ? cy + HIZ_SIZE : y1;
+		for (int cx = x0 & ~(HIZ_SIZE - 1); cx < x1; cx += HIZ_SIZE)
 		{
-			bool in_scissor_rect = false;
-			for (auto& r : m_scissor_rects)
+			int bx0 = cx > x0 ? cx : x0;
+			int bx1 = cx + HIZ_SIZE < x1 ? cx + HIZ_SIZE : x1;
+			Coverage coverage = setup.fixed_point ? ClassifyBlock(setup, bx0, by0, bx1, by1) : Coverage::Partial;
+			if (coverage == Coverage::Outside)
+			{
+				continue;
+			}
+
+			//the whole block is behind what is drawn there already,
+			//after the pre-pass a block in front of everything cannot match either.
+			//early z assumes no fragment writes stencil, see EarlyDepthTest.
+			int block = (cy / HIZ_SIZE) * m_hiz_cols + cx / HIZ_SIZE;
+			float zmin, zmax;
+			BlockDepthRange(setup, bx0, by0, bx1, by1, zmin, zmax);
+			if (zmax < 0.0f || zmin >= m_hiz_max[block] || (pass == DrawPass::Shade && zmax < m_hiz_min[block]))
+			{
+				continue;
+			}
+
+			//in front of everything drawn there, no pixel needs the early test.
+			bool visible = zmin >= 0.0f && zmax < m_hiz_min[block];
+			ForEachPixel(setup, bx0, by0, bx1, by1, [&](int x, int y, float u, float v)
 			{
-				if (r.contains(f.x, f.y))
+				if (pass == DrawPass::Depth)
 				{
-					in_scissor_rect = true;
-					break;
+					int index = PixelIndex(x, m_height - y - 1);
+					float z = InterpolateDepth(setup, u, v);
+					if ((visible || (z >= 0.0f && z < LoadDepth(index))) && ScissorTest(x, m_height - y - 1))
+					{
+						StoreDepth(index, z);
+					}
+					return;
 				}
-			}
-			if (!in_scissor_rect)
+
+				if (pass == DrawPass::Shade)
+				{
+					//only the fragment that won the pre-pass gets shaded.
+					int index = PixelIndex(x, m_height - y - 1);
+					if (!DepthEqual(index, InterpolateDepth(setup, u, v)))
+					{
+						return;
+					}
+				}
+
+				Fragment f, of;
+				InterpolateFragment(setup, x, y, u, v, f);
+				if (pass == DrawPass::Color && !visible && !EarlyDepthTest(f))
+				{
+					return;
+				}
+				ShadeFragment(f, of);
+				MergeFragment(of, pass == DrawPass::Shade);
+			});
+
+			//the shade pass keeps the depth of the pre-pass.
+			if (pass == DrawPass::Shade)
 			{
 				continue;
 			}
+
+			//written depths are never below zmin, nor below 0.
+			float lower = zmin > 0.0f ? zmin : 0.0f;
+			if (lower < m_hiz_min[block])
+			{
+				m_hiz_min[block] = lower;
+			}
+			if (coverage == Coverage::Inside)
+			{
+				RefreshHiZ(cx / HIZ_SIZE, cy / HIZ_SIZE);
+			}
+		}
+	}
+}
+
+bool Renderer::EarlyDepthTest(const Fragment& f) const
+{
+	//stencil ops run before the z-test and write even when it fails. the block reject in DrawPixels
+	//drops fragments it never creates, so early z as a whole assumes no fragment writes stencil.
+	//the pixel shader keeps z, so what fails here fails the z-test in MergeFragment too.
+	//the depth write stays there, behind the alpha test that may still discard the fragment.
+	int index = PixelIndex(f.x, f.y);
+	return f.z >= 0.0f && f.z < LoadDepth(index);
+}
+
+void Renderer::RefreshHiZ(int hx, int hy)
+{
+	int x0 = hx * HIZ_SIZE;
+	int y0 = hy * HIZ_SIZE;
+	int x1 = x0 + HIZ_SIZE < m_width ? x0 + HIZ_SIZE : m_width;
+	int y1 = y0 + HIZ_SIZE < m_height ? y0 + HIZ_SIZE : m_height;
+
+	float zmax = 0.0f;
+	for (int y = y0; y < y1; y++)
+	{
+		int row = m_height - y - 1;
+		for (int x = x0; x < x1; x++)
+		{
+			float z = LoadDepth(PixelIndex(x, row));
+			zmax = z > zmax ? z : zmax;
 		}
+	}
+	m_hiz_max[hy * m_hiz_cols + hx] = zmax;
+}
+
+void Renderer::FusedPipeline()
+{
+	//with the pre-pass every triangle goes through twice, depth only and then shading.
+	DrawPass passes[2] = { DrawPass::Depth, DrawPass::Shade };
+	int pass_count = 2;
+	if (!m_depth_prepass)
+	{
+		passes[0] = DrawPass::Color;
+		pass_count = 1;
+	}
 
-		//stencil-test
-		if (f.stencil >= 0)
+	for (int p = 0; p < pass_count; p++)
+	{
+		for (int triangle = 0; triangle < m_triangle_count; triangle++)
 		{
-			if (f.stencil > m_stencil_buffer[index])
+			TriangleSetup setup;
+			if (!SetupTriangle(triangle, setup))
 			{
-				m_stencil_buffer[index] = f.stencil;
+				continue;
 			}
-			else
+
+			//pixels of one triangle never overlap, so the tile order does not change the result.
+			//tiles sit on the screen grid, so the pixel blocks inside never straddle two of them.
+			for (int tile_y = setup.ymin - setup.ymin % TILE_SIZE; tile_y < setup.ymax; tile_y += TILE_SIZE)
 			{
-				continue; ///discard;
+				int ty = tile_y > setup.ymin ? tile_y : setup.ymin;
+				int tyend = tile_y + TILE_SIZE < setup.ymax ? tile_y + TILE_SIZE : setup.ymax;
+				for (int tile_x = setup.xmin - setup.xmin % TILE_SIZE; tile_x < setup.xmax; tile_x += TILE_SIZE)
+				{
+					int tx = tile_x > setup.xmin ? tile_x : setup.xmin;
+					int txend = tile_x + TILE_SIZE < setup.xmax ? tile_x + TILE_SIZE : setup.xmax;
+					ClearTile((tile_y / TILE_SIZE) * m_tile_cols + tile_x / TILE_SIZE, false);
+					DrawPixels(setup, tx, ty, txend, tyend, passes[p]);
+				}
 			}
 		}
+	}
+}
+
+void Renderer::BinnedPipeline()
+{
+	int tile_cols = (m_width + TILE_SIZE - 1) / TILE_SIZE;
+	int tile_rows = (m_height + TILE_SIZE - 1) / TILE_SIZE;
+	tile_bins.resize(tile_cols * tile_rows);
+	for (auto& bin : tile_bins)
+	{
+		bin.clear();
+	}
 
-		// z-test
-		if (f.z >= 0.0f && f.z < m_depth_buffer[index])
+	//sort-middle, each triangle is set up once and appended to the tiles it touches in submission order.
+	triangle_setups.resize(m_triangle_count);
+	for (int triangle = 0; triangle < m_triangle_count; triangle++)
+	{
+		TriangleSetup& setup = triangle_setups[triangle];
+		if (!SetupTriangle(triangle, setup) || setup.xmin >= setup.xmax || setup.ymin >= setup.ymax)
 		{
-			m_depth_buffer[index] = f.z;
+			continue;
 		}
-		else
+
+		for (int ty = setup.ymin / TILE_SIZE; ty <= (setup.ymax - 1) / TILE_SIZE; ty++)
 		{
-			continue; ///discard;
+			int y0 = ty * TILE_SIZE > setup.ymin ? ty * TILE_SIZE : setup.ymin;
+			int y1 = (ty + 1) * TILE_SIZE < setup.ymax ? (ty + 1) * TILE_SIZE : setup.ymax;
+			for (int tx = setup.xmin / TILE_SIZE; tx <= (setup.xmax - 1) / TILE_SIZE; tx++)
+			{
+				int x0 = tx * TILE_SIZE > setup.xmin ? tx * TILE_SIZE : setup.xmin;
+				int x1 = (tx + 1) * TILE_SIZE < setup.xmax ? (tx + 1) * TILE_SIZE : setup.xmax;
+				if (setup.fixed_point && ClassifyBlock(setup, x0, y0, x1, y1) == Coverage::Outside)
+				{
+					continue;
+				}
+				tile_bins[ty * tile_cols + tx].push_back(triangle);
+			}
 		}
+	}
 
-		// blending
-		auto& dst = m_color_buffer[index];
-		auto& src = f.color;
-		dst.replace(gml::lerp(
-			gml::swizzle<gml::_R, gml::_G, gml::_B>(dst),
-			gml::swizzle<gml::_R, gml::_G, gml::_B>(src),
-			src.a));
+	//with the pre-pass a tile runs its triangles twice, depth only and then shading.
+	DrawPass passes[2] = { DrawPass::Depth, DrawPass::Shade };
+	int pass_count = 2;
+	if (!m_depth_prepass)
+	{
+		passes[0] = DrawPass::Color;
+		pass_count = 1;
 	}
+
+	//every tile owns its pixels, so workers write the buffers without locks.
+	m_pool->ParallelFor(tile_cols * tile_rows, [&](int tile)
+	{
+		//the tile is about to be drawn, so its clear goes through the cache.
+		if (!tile_bins[tile].empty())
+		{
+			ClearTile(tile, false);
+		}
+
+		int tx = tile % tile_cols;
+		int ty = tile / tile_cols;
+		for (int p = 0; p < pass_count; p++)
+		{
+			for (int triangle : tile_bins[tile])
+			{
+				const TriangleSetup& setup = triangle_setups[triangle];
+				int x0 = tx * TILE_SIZE > setup.xmin ? tx * TILE_SIZE : setup.xmin;
+				int y0 = ty * TILE_SIZE > setup.ymin ? ty * TILE_SIZE : setup.ymin;
+				int x1 = (tx + 1) * TILE_SIZE < setup.xmax ? (tx + 1) * TILE_SIZE : setup.xmax;
+				int y1 = (ty + 1) * TILE_SIZE < setup.ymax ? (ty + 1) * TILE_SIZE : setup.ymax;
+				DrawPixels(setup, x0, y0, x1, y1, passes[p]);
+			}
+		}
+	});
 }
 
-void Renderer::CopyBuffer(byte* buffer, int width, int height, int pitch)
+void Renderer::SetPipeline(RenderPipeline pipeline)
 {
-	for (int h = 0; h < height; h++)
+	m_pipeline = pipeline;
+}
+
+void Renderer::SetEarlyZ(bool enabled)
+{
+	m_early_z = enabled;
+}
+
+void Renderer::SetDepthPrepass(bool enabled)
+{
+	m_depth_prepass = enabled;
+}
+
+void Renderer::SetResolveFilter(ResolveFilter filter)
+{
+	m_resolve_filter = filter;
+	m_resolve_width = 0;
+}
+
+void Renderer::SetResolveSrgb(bool enabled)
+{
+	m_resolve_srgb = enabled;
+}
+
+void Renderer::SetResolveDither(bool enabled)
+{
+	m_resolve_dither = enabled;
+}
+
+void Renderer::BuildResolveTables(int width, int height)
+{
+	m_resolve_width = width;
+	m_resolve_height = height;
+	m_resolve_cols.resize(width);
+	m_resolve_col_weights.resize(width);
+	m_resolve_rows.resize(height);
+	m_resolve_row_weights.resize(height);
+
+	int sizes[2] = { width, height };
+	int limits[2] = { m_width, m_height };
+	std::vector<int>* indices[2] = { &m_resolve_cols, &m_resolve_rows };
+	std::vector<float>* weights[2] = { &m_resolve_col_weights, &m_resolve_row_weights };
+	for (int axis = 0; axis < 2; axis++)
 	{
-		for (int w = 0; w < width; w++)
+		for (int i = 0; i < sizes[axis]; i++)
 		{
-			int index = pitch * h + w * 3;
-			int u = (int)(w * 1.0f / width * m_width + 0.5f);
-			int v = (int)(h * 1.0f / height * m_height + 0.5f);
-			int src_index = v * m_width + u;
-			//point sample
-			gml::color4& color = m_color_buffer[src_index].clamped();
+			int index;
+			float weight = 0.0f;
+			if (m_resolve_filter == ResolveFilter::Bilinear)
+			{
+				//pixel centers of the output on the buffer, the right or lower neighbour gets the weight.
+				float s = (i + 0.5f) * limits[axis] / sizes[axis] - 0.5f;
+				s = s > 0.0f ? (s < limits[axis] - 1.0f ? s : limits[axis] - 1.0f) : 0.0f;
+				index = static_cast<int>(s);
+				weight = s - index;
+			}
+			else
+			{
+				index = (int)(i * 1.0f / sizes[axis] * limits[axis] + 0.5f);
+				index = index < limits[axis] ? index : limits[axis] - 1;
+			}
+			(*indices[axis])[i] = index;
+			(*weights[axis])[i] = weight;
+		}
+	}
+}
 
-			unsigned int color32 = color.rgba();
-			buffer[index + 0] = (color32 >> 16) & 0xFF;
-			buffer[index + 1] = (color32 >> 8) & 0xFF;
-			buffer[index + 2] = color32 & 0xFF;
+const gml::color4* Renderer::ResolveSourceRow(int row, gml::color4* scratch) const
+{
+	int tile_row = ((m_height - 1 - row) / TILE_SIZE) * m_tile_cols;
+	bool direct = m_color_format == ColorFormat::RGBA32F && !m_tiled_layout;
+	for (int tile = 0; tile < m_tile_cols && direct; tile++)
+	{
+		direct = (m_tile_clears[tile_row + tile] & CLEAR_COLOR) == 0;
+	}
+	if (direct)
+	{
+		return reinterpret_cast<const gml::color4*>(m_color_buffer) + row * m_width;
+	}
+
+	//rounded through the format, as if the clear had been written.
+	byte encoded[sizeof(gml::color4)];
+	EncodeColor(m_color_format, ClearColor(row), encoded);
+	gml::color4 clear = DecodeColor(m_color_format, encoded);
+	for (int tile = 0; tile < m_tile_cols; tile++)
+	{
+		int x0 = tile * TILE_SIZE;
+		int x1 = x0 + TILE_SIZE < m_width ? x0 + TILE_SIZE : m_width;
+		bool cleared = (m_tile_clears[tile_row + tile] & CLEAR_COLOR) != 0;
+		for (int x = x0; x < x1; x++)
+		{
+			scratch[x] = cleared ? clear : LoadColor(PixelIndex(x, row));
 		}
 	}
+	return scratch;
+}
+
+void Renderer::CopyBuffer(byte* buffer, int width, int height, int pitch)
+{
+	if (width != m_resolve_width || height != m_resolve_height)
+	{
+		BuildResolveTables(width, height);
+	}
+
+	//bands of output rows in parallel, each one decodes the buffer rows it samples once.
+	const int BAND_ROWS = 16;
+	bool bilinear = m_resolve_filter == ResolveFilter::Bilinear;
+	m_pool->ParallelFor((height + BAND_ROWS - 1) / BAND_ROWS, [&](int band)
+	{
+		std::vector<gml::color4> scratch(m_width * 2 + width);
+		gml::color4* line = scratch.data() + m_width * 2;
+		int cached[2] = { -1, -1 };
+		const gml::color4* rows[2] = { nullptr, nullptr };
+
+		int h1 = (band + 1) * BAND_ROWS < height ? (band + 1) * BAND_ROWS : height;
+		for (int h = band * BAND_ROWS; h < h1; h++)
+		{
+			//the lower row only matters for bilinear, it is the upper one again at the bottom edge.
+			int v = m_resolve_rows[h];
+			int source_rows[2] = { v, bilinear && v + 1 < m_height ? v + 1 : v };
+			for (int k = 0; k < (bilinear ? 2 : 1); k++)
+			{
+				if (cached[k] != source_rows[k])
+				{
+					cached[k] = source_rows[k];
+					rows[k] = ResolveSourceRow(source_rows[k], scratch.data() + m_width * k);
+				}
+			}
+
+			if (bilinear)
+			{
+				__m128 fy = _mm_set1_ps(m_resolve_row_weights[h]);
+				for (int w = 0; w < width; w++)
+				{
+					int u0 = m_resolve_cols[w];
+					int u1 = u0 + 1 < m_width ? u0 + 1 : u0;
+					__m128 fx = _mm_set1_ps(m_resolve_col_weights[w]);
+					__m128 top = LerpColors(rows[0][u0], rows[0][u1], fx);
+					__m128 bottom = LerpColors(rows[1][u0], rows[1][u1], fx);
+					_mm_storeu_ps(&line[w].r, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), fy)));
+				}
+			}
+			else
+			{
+				for (int w = 0; w < width; w++)
+				{
+					line[w] = rows[0][m_resolve_cols[w]];
+				}
+			}
+
+			float bias[4];
+			for (int i = 0; i < 4; i++)
+			{
+				bias[i] = m_resolve_dither ? (BAYER_4X4[h & 3][i] + 0.5f) / 16.0f : 0.5f;
+			}
+			ConvertPixels(line, width, bias, m_resolve_srgb, buffer + pitch * h);
+		}
+	});
 }
 
 void Renderer::PushScissorRect()
@@ -0,0 +1,88 @@
+#include "pch.h"
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(int worker_count)
+{
+	m_next = 0;
+	for (int i = 0; i < worker_count; i++)
+	{
+		m_workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (auto& t : m_workers)
+	{
+		t.join();
+	}
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int)>& func)
+{
+	if (count <= 1 || m_workers.empty())
+	{
+		for (int i = 0; i < count; i++)
+		{
+			func(i);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_func = &func;
+		m_count = count;
+		m_next = 0;
+		m_generation++;
+	}
+	m_wake.notify_all();
+
+	RunItems();
+
+	//workers that joined late may still hold an item, close the loop once they are out.
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this] { return m_busy == 0; });
+	m_func = nullptr;
+	m_count = 0;
+}
+
+void ThreadPool::RunItems()
+{
+	int index;
+	while ((index = m_next++) < m_count)
+	{
+		(*m_func)(index);
+	}
+}
+
+void ThreadPool::WorkerLoop()
+{
+	unsigned int seen = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [&] { return m_stop || (m_func != nullptr && m_generation != seen); });
+			if (m_stop)
+			{
+				return;
+			}
+			seen = m_generation;
+			m_busy++;
+		}
+
+		RunItems();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_busy--;
+		}
+		m_done.notify_all();
+	}
+}
\ No newline at end of file
@@ -2,6 +2,52 @@
 
 class IScene;
 
+//one camera and the image it renders into, see IRenderer::PresentViews.
+struct RenderView
+{
+	float Eye[3] = { 0.0f, 0.0f, 0.0f };
+	float Target[3] = { 0.0f, 0.0f, -1.0f };
+	float Up[3] = { 0.0f, 1.0f, 0.0f };
+	float FOV = 30.0f;
+
+	unsigned char* Buffer = nullptr;
+	int Width = 0;
+	int Height = 0;
+	int Pitch = 0;
+
+	//rows count from the top of the buffer, an empty region renders the whole image.
+	int RegionX = 0;
+	int RegionY = 0;
+	int RegionWidth = 0;
+	int RegionHeight = 0;
+};
+
+enum class PixelOrder
+{
+	RowMajor,
+	Morton,
+	Hilbert,
+};
+
+enum class ImageFormat
+{
+	Ppm,	//one file per frame, the path is a printf pattern such as "frame%04d.ppm"
+	Y4m,	//a single yuv 4:4:4 stream for the whole range
+};
+
+//offline rendering of a frame range from the renderer's camera, see IRenderer::RenderAnimation.
+struct AnimationDesc
+{
+	int FirstFrame = 0;
+	int FrameCount = 0;
+	int Width = 0;
+	int Height = 0;
+
+	ImageFormat Format = ImageFormat::Ppm;
+	const char* Path = nullptr;
+	int FrameRate = 30;
+};
+
 class IRenderer
 {
 public:
@@ -11,5 +57,17 @@ public:
 
 	virtual void Release(); 
 
+	virtual void SetPixelOrder(PixelOrder order) = 0;
+
+	//shadow rays per hit for many-light scenes, 0 evaluates every light.
+	virtual void SetLightSampleCount(int count) = 0;
+
 	virtual void Present(const IScene* scene, unsigned char* buffer, int width, int height, int pitch) = 0;
+
+	//renders every view of the batch in one pass, tiles of all views share the worker queue.
+	virtual void PresentViews(const IScene* scene, const RenderView* views, int count) = 0;
+
+	//renders sceneCount frames at a time, each into its own scene, which must all hold
+	//the same content. finished frames are written by a background thread meanwhile.
+	virtual bool RenderAnimation(IScene* const* scenes, int sceneCount, const AnimationDesc& desc) = 0;
 };
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+#include <functional>
+#include "irenderer.h"
+
+class IScene;
+
+enum class RenderJobState
+{
+	Queued,
+	Running,
+	Completed,
+	Cancelled,
+};
+
+struct RenderJobDesc
+{
+	const IScene* Scene = nullptr;
+
+	//camera, target buffer and resolution, a region renders part of the image only.
+	RenderView View;
+
+	//higher priorities take every free worker first, equal ones share them tile by tile.
+	int Priority = 0;
+
+	//called after each finished tile, from whichever thread rendered it.
+	std::function<void(int finishedTiles, int tileCount)> Progress;
+};
+
+//the scene and the buffer must stay alive until Wait returns, also after Cancel.
+class IRenderJob
+{
+public:
+	virtual ~IRenderJob();
+
+	virtual void Release() = 0;
+
+	//tiles already being rendered finish, no new ones are started.
+	virtual void Cancel() = 0;
+
+	virtual RenderJobState GetState() const = 0;
+
+	//blocks until the job is completed or cancelled.
+	virtual RenderJobState Wait() = 0;
+};
+
+//renders jobs from any number of callers on the shared worker pool, one tile at a time,
+//so a new job with a higher priority gets the workers as soon as their current tiles are done.
+class IRenderService
+{
+public:
+	static IRenderService* Create();
+
+	virtual ~IRenderService();
+
+	//cancels the jobs still running and waits for their tiles.
+	virtual void Release();
+
+	//set before submitting, jobs in flight read it from every tile.
+	virtual void SetLightSampleCount(int count) = 0;
+
+	virtual IRenderJob* Submit(const RenderJobDesc& desc) = 0;
+};
\ No newline at end of file
@@ -7,25 +7,53 @@ namespace gml
 }
 
 class HitInfo;
+class IBoundsFilter;
 class ISceneObject;
 class Light;
 
+enum class SceneAccelerator
+{
+	Octree,
+	Grid,
+	Bvh4,
+};
+
 class IScene
 {
 public:
-	static IScene* Create();
+	static IScene* Create(SceneAccelerator accelerator = SceneAccelerator::Octree);
+
+	//text description or binary snapshot, nullptr when the file can not be loaded.
+	static IScene* Create(const char* path);
+
+	//writes a snapshot of a text description, loading it later skips parsing and the bvh build.
+	static bool Convert(const char* textPath, const char* snapshotPath);
 
 	virtual ~IScene();
 
 	virtual void Release();
 
+	//advances the animation by one frame.
 	virtual void Update() = 0;
 
+	//jumps straight to a frame of the animation, Update continues from there.
+	virtual void SetFrame(int frame) = 0;
+
 	virtual ISceneObject* IntersectWithRay(const gml::ray& ray, HitInfo& info, ISceneObject* exclude = nullptr) const = 0;
 
+	virtual int GetObjectCount() const = 0;
+
+	virtual ISceneObject* GetSceneObject(int index) const = 0;
+
+	//objects whose bounds pass the filter, found through the accelerator, unbounded ones always pass.
+	//false once more than maxCount objects pass, objects then holds the first maxCount of them.
+	virtual bool QueryObjects(const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count) const = 0;
+
 	virtual const Light* GetLightList() const = 0;
 
 	virtual int GetLightCount() const = 0;
 
+	virtual int SampleLight(const gml::vec3& position, float u, float& pdf) const = 0;
+
 	virtual const gml::color3& GetAmbientColor() const = 0;
 };
\ No newline at end of file
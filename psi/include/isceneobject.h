@@ -3,11 +3,31 @@
 #include <gmlaabb.h>
 #include <gmlray.h>
 
+//filled during traversal, only enough to find the closest hit.
 class HitInfo
 {
 public:
 	float t;
+	int primitive = 0;
+	float u = 0.0f;
+	float v = 0.0f;
+};
+
+//region test for IScene::QueryObjects. it is asked for accelerator nodes as well as objects,
+//so it may only reject boxes that lie entirely outside the region.
+class IBoundsFilter
+{
+public:
+	virtual bool Overlaps(const gml::aabb& aabb) const = 0;
+};
+
+//shading attributes, computed once for the final hit.
+class SurfaceInfo
+{
+public:
+	gml::vec3 position;
 	gml::vec3 normal;
+	const Material* material = nullptr;
 };
 
 class ISceneObject
@@ -17,7 +37,7 @@ public:
 	static ISceneObject* CreatePlane(const gml::vec3& position, const gml::vec3& normal);
 	static ISceneObject* CreateBox(const gml::vec3& position, const gml::vec3& extends);
 	static ISceneObject* CreatePyramid(const gml::vec3& position, float extends);
-	static ISceneObject* CreateModel(const gml::vec3& position, float size);
+	static ISceneObject* CreateModel(const gml::vec3& position, float size, float yaw = 0.0f);
 
 	virtual ~ISceneObject();
 
@@ -25,6 +45,8 @@ public:
 
 	virtual bool IntersectWithRay(const gml::ray& ray, float mint, HitInfo& info) const = 0;
 
+	virtual void ComputeSurface(const gml::ray& ray, const HitInfo& info, SurfaceInfo& surface) const = 0;
+
 	virtual const gml::aabb& GetAABB() const = 0;
 
 	virtual void SetPosition(float x, float y, float z) = 0;
@@ -19,4 +19,7 @@ public:
 
 	//ʱǿȣջûʼд
 	float Intensity = 1.0f;
+
+	//smooth falloff to zero at this distance, 0 for no falloff.
+	float Range = 0.0f;
 };
\ No newline at end of file
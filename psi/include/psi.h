@@ -1,6 +1,6 @@
 #pragma once
 
 void Present(HDC windowDC);
-bool Initialize(HWND hWnd);
+bool Initialize(HWND hWnd, const char* scenePath = nullptr);
 void Uninitialize(HWND hWnd);
 bool NeedUpdate();
\ No newline at end of file
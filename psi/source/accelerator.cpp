@@ -0,0 +1,45 @@
+#include "pch.h"
+#include "accelerator.h"
+#include "scene.h"
+#include "grid.h"
+#include "bvh4.h"
+#include "geometry.h"
+
+Accelerator* Accelerator::Create(SceneAccelerator type)
+{
+	switch (type)
+	{
+	case SceneAccelerator::Grid:
+		return new Grid();
+	case SceneAccelerator::Bvh4:
+		return new Bvh4Accelerator();
+	default:
+		return new Octree();
+	}
+}
+
+Accelerator::~Accelerator()
+{
+
+}
+
+void Accelerator::Release()
+{
+	delete this;
+}
+
+bool AddQueryObject(ISceneObject* object, const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count)
+{
+	const gml::aabb& aabb = object->GetAABB();
+	if (IsBounded(aabb) && !filter.Overlaps(aabb))
+	{
+		return true;
+	}
+
+	if (count == maxCount)
+	{
+		return false;
+	}
+	objects[count++] = object;
+	return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <vector>
+#include <iscene.h>
+#include <isceneobject.h>
+
+class Accelerator
+{
+public:
+	static Accelerator* Create(SceneAccelerator type);
+
+	virtual ~Accelerator();
+
+	virtual void Release();
+
+	virtual void Build(const std::vector<ISceneObject*>& objects) = 0;
+
+	virtual ISceneObject* IntersectWithRay(const gml::ray& ray, HitInfo& info, ISceneObject* exclude) const = 0;
+
+	virtual bool QueryObjects(const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count) const = 0;
+};
+
+//adds object to a query result when it passes the filter, false when the result is full.
+bool AddQueryObject(ISceneObject* object, const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count);
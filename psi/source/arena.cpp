@@ -0,0 +1,85 @@
+#include "pch.h"
+#include "arena.h"
+
+Arena::Arena(size_t chunkSize) : mChunkSize(chunkSize)
+{
+
+}
+
+Arena::~Arena()
+{
+	FreeChunks(mFirst);
+}
+
+void* Arena::Allocate(size_t size, size_t alignment)
+{
+	unsigned char* p = reinterpret_cast<unsigned char*>((reinterpret_cast<size_t>(mCursor) + alignment - 1) & ~(alignment - 1));
+	if (mCursor == nullptr || p + size > mEnd)
+	{
+		//the first chunk survives Reset and is reused when large enough, new chunks double in size.
+		Chunk* chunk = (mCurrent == nullptr) ? mFirst : nullptr;
+		if (chunk == nullptr || chunk->Size < size + alignment)
+		{
+			if (chunk != nullptr)
+			{
+				FreeChunks(chunk);
+				mFirst = nullptr;
+			}
+
+			size_t chunkSize = (mCurrent != nullptr) ? mCurrent->Size * 2 : mChunkSize;
+			while (chunkSize < size + alignment)
+			{
+				chunkSize *= 2;
+			}
+
+			chunk = static_cast<Chunk*>(::operator new(sizeof(Chunk) + chunkSize));
+			chunk->Next = nullptr;
+			chunk->Size = chunkSize;
+			if (mCurrent != nullptr)
+			{
+				mCurrent->Next = chunk;
+			}
+			else
+			{
+				mFirst = chunk;
+			}
+		}
+
+		mCurrent = chunk;
+		mCursor = reinterpret_cast<unsigned char*>(chunk + 1);
+		mEnd = mCursor + chunk->Size;
+		p = reinterpret_cast<unsigned char*>((reinterpret_cast<size_t>(mCursor) + alignment - 1) & ~(alignment - 1));
+	}
+
+	mCursor = p + size;
+	return p;
+}
+
+void Arena::Reset()
+{
+	//a filled arena is likely to be filled again, so several chunks merge into one.
+	if (mFirst != nullptr && mFirst->Next != nullptr)
+	{
+		size_t total = 0;
+		for (Chunk* chunk = mFirst; chunk != nullptr; chunk = chunk->Next)
+		{
+			total += chunk->Size;
+		}
+		FreeChunks(mFirst);
+		mFirst = nullptr;
+		mChunkSize = total;
+	}
+	mCurrent = nullptr;
+	mCursor = nullptr;
+	mEnd = nullptr;
+}
+
+void Arena::FreeChunks(Chunk* chunk)
+{
+	while (chunk != nullptr)
+	{
+		Chunk* next = chunk->Next;
+		::operator delete(chunk);
+		chunk = next;
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <new>
+#include <stddef.h>
+
+//bump allocator for data that lives exactly as long as its owner, such as the
+//objects of a scene or the nodes of a tree. memory comes from a few large chunks,
+//is never returned piece by piece and no destructors run, so only types whose
+//destructor has nothing to free may be placed here. not thread safe.
+class Arena
+{
+public:
+	explicit Arena(size_t chunkSize = 64 * 1024);
+
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator = (const Arena&) = delete;
+
+	void* Allocate(size_t size, size_t alignment = 16);
+
+	template<typename T, typename... Args>
+	T* New(const Args&... args)
+	{
+		return new (Allocate(sizeof(T), alignof(T))) T(args...);
+	}
+
+	template<typename T>
+	T* NewArray(int count)
+	{
+		return count > 0 ? static_cast<T*>(Allocate(sizeof(T) * count, alignof(T))) : nullptr;
+	}
+
+	//drops everything at once, the memory is kept for the next fill.
+	void Reset();
+
+private:
+	struct Chunk
+	{
+		Chunk* Next;
+		size_t Size;
+	};
+
+	void FreeChunks(Chunk* chunk);
+
+	size_t mChunkSize;
+	Chunk* mFirst = nullptr;
+	Chunk* mCurrent = nullptr;
+	unsigned char* mCursor = nullptr;
+	unsigned char* mEnd = nullptr;
+};
@@ -0,0 +1,627 @@
+#include "pch.h"
+#include <algorithm>
+#include <float.h>
+#include "bvh4.h"
+#include "geometry.h"
+#include "threadpool.h"
+
+namespace
+{
+	const int MAX_LEAF_OBJECTS = 2;
+
+	const int SAH_BIN_COUNT = 16;
+	const int MORTON_BITS = 10;
+
+	//ranges below this are built or scanned by the thread that owns them.
+	const int PARALLEL_CHUNK = 4096;
+
+	struct SahBin
+	{
+		gml::aabb Bounds;
+		int Count = 0;
+	};
+
+	float HalfArea(const gml::aabb& aabb)
+	{
+		gml::vec3 size = aabb.max_bound() - aabb.min_bound();
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+	void Merge(gml::aabb& aabb, const gml::aabb& other)
+	{
+		aabb.expand(other.min_bound());
+		aabb.expand(other.max_bound());
+	}
+
+	int LongestAxis(const gml::aabb& aabb)
+	{
+		gml::vec3 size = aabb.max_bound() - aabb.min_bound();
+		return (size.x > size.y) ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+	}
+
+	//func(chunk, begin, end) over [start, start + count), chunks run on the pool.
+	template<typename Func>
+	int ForEachChunk(int start, int count, const Func& func)
+	{
+		int chunks = (count + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+		if (chunks <= 1)
+		{
+			func(0, start, start + count);
+			return 1;
+		}
+
+		ThreadPool::Get().ParallelFor(chunks, [&](int chunk)
+		{
+			int begin = start + chunk * PARALLEL_CHUNK;
+			int end = begin + PARALLEL_CHUNK < start + count ? begin + PARALLEL_CHUNK : start + count;
+			func(chunk, begin, end);
+		});
+		return chunks;
+	}
+
+	int ChunkCount(int count)
+	{
+		int chunks = (count + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+		return chunks > 1 ? chunks : 1;
+	}
+
+	//spreads the low 10 bits of v so two zero bits follow each one.
+	unsigned int ExpandBits(unsigned int v)
+	{
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+}
+
+RayContext::RayContext(const gml::ray& ray)
+{
+	gml::vec3 origin = ray.origin();
+	gml::vec3 invDir = ray.direction().inversed();
+	for (int axis = 0; axis < 3; axis++)
+	{
+		Origin[axis] = _mm_set1_ps(origin[axis]);
+		InvDir[axis] = _mm_set1_ps(invDir[axis]);
+		Sign[axis] = invDir[axis] < 0.0f ? 1 : 0;
+	}
+}
+
+void Bvh4::Build(const std::vector<gml::aabb>& bounds, int maxLeafSize, BvhBuild mode)
+{
+	mMaxLeafSize = maxLeafSize;
+	mMode = mode;
+	mNodes.clear();
+
+	int count = static_cast<int>(bounds.size());
+	mPrimitives.resize(count);
+	mCentroids.resize(count);
+	ForEachChunk(0, count, [this, &bounds](int, int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			mPrimitives[i] = i;
+			mCentroids[i] = bounds[i].center();
+		}
+	});
+
+	if (count > 0)
+	{
+		mBuildBounds = &bounds;
+		if (mode == BvhBuild::Morton)
+		{
+			SortMorton();
+		}
+
+		//every inner node has two children at least, so count nodes always suffice.
+		mNodes.resize(count);
+		mNextNode = 0;
+		BuildNode(0, count, 1);
+		mNodes.resize(mNextNode);
+		mBuildBounds = nullptr;
+	}
+
+	std::vector<gml::vec3>().swap(mCentroids);
+	std::vector<unsigned int>().swap(mMortonCodes);
+
+	mNodeData = mNodes.empty() ? nullptr : &(mNodes[0]);
+	mNodeCount = static_cast<int>(mNodes.size());
+	mPrimitiveData = mPrimitives.empty() ? nullptr : &(mPrimitives[0]);
+	mPrimitiveCount = count;
+}
+
+bool Bvh4::Attach(const void* nodes, int nodeCount, const int* primitives, int primitiveCount)
+{
+	//children always follow their parent, so one pass finds the deepest level of every node.
+	const Node* nodeData = static_cast<const Node*>(nodes);
+	std::vector<int> depths(nodeCount, 1);
+	for (int n = 0; n < nodeCount; n++)
+	{
+		if (depths[n] > MAX_DEPTH)
+		{
+			return false;
+		}
+
+		for (int c = 0; c < 4; c++)
+		{
+			int child = nodeData[n].Child[c];
+			int childCount = nodeData[n].Count[c];
+			bool empty = nodeData[n].Bounds[0][0][c] > nodeData[n].Bounds[1][0][c];
+			if ((childCount < 0 && !empty) ||
+				(childCount == 0 && (child <= n || child >= nodeCount)) ||
+				(childCount > 0 && (child < 0 || child + childCount > primitiveCount)))
+			{
+				return false;
+			}
+
+			if (childCount == 0 && depths[child] < depths[n] + 1)
+			{
+				depths[child] = depths[n] + 1;
+			}
+		}
+	}
+
+	mNodes.clear();
+	mPrimitives.clear();
+	mNodeData = nodeData;
+	mNodeCount = nodeCount;
+	mPrimitiveData = primitives;
+	mPrimitiveCount = primitiveCount;
+	return true;
+}
+
+gml::aabb Bvh4::GetBounds(int start, int count, bool centroids) const
+{
+	std::vector<gml::aabb> partial(ChunkCount(count));
+	ForEachChunk(start, count, [this, &partial, centroids](int chunk, int begin, int end)
+	{
+		gml::aabb aabb;
+		for (int i = begin; i < end; i++)
+		{
+			if (centroids)
+			{
+				aabb.expand(mCentroids[mPrimitives[i]]);
+			}
+			else
+			{
+				Merge(aabb, (*mBuildBounds)[mPrimitives[i]]);
+			}
+		}
+		partial[chunk] = aabb;
+	});
+
+	gml::aabb aabb = partial[0];
+	for (size_t i = 1; i < partial.size(); i++)
+	{
+		Merge(aabb, partial[i]);
+	}
+	return aabb;
+}
+
+void Bvh4::SortMorton()
+{
+	int count = static_cast<int>(mPrimitives.size());
+	gml::aabb centroidAABB = GetBounds(0, count, true);
+	gml::vec3 minBound = centroidAABB.min_bound();
+	gml::vec3 size = centroidAABB.max_bound() - minBound;
+	float scale[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		scale[axis] = size[axis] > 0.0f ? ((1 << MORTON_BITS) - 1) / size[axis] : 0.0f;
+	}
+
+	//code in the high half, primitive in the low half.
+	std::vector<unsigned long long> keys(count);
+	ForEachChunk(0, count, [&](int, int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			gml::vec3 offset = mCentroids[i] - minBound;
+			unsigned int code = 0;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				code |= ExpandBits(static_cast<unsigned int>(offset[axis] * scale[axis])) << (2 - axis);
+			}
+			keys[i] = (static_cast<unsigned long long>(code) << 32) | static_cast<unsigned int>(i);
+		}
+	});
+
+	//lsd radix sort on the 30 code bits, 11 bits per pass. every chunk counts its own digits and
+	//scatters from its own offsets, chunks of a digit follow each other so the sort stays stable.
+	const int RADIX_BITS = 11;
+	const int RADIX_SIZE = 1 << RADIX_BITS;
+	const int DIGIT_GROUP = 64;
+	int chunks = ChunkCount(count);
+	std::vector<unsigned long long> sorted(count);
+	std::vector<int> offsets(chunks * RADIX_SIZE);
+	std::vector<int> digitStart(RADIX_SIZE);
+	for (int shift = 32; shift < 32 + 3 * MORTON_BITS; shift += RADIX_BITS)
+	{
+		ForEachChunk(0, count, [&](int chunk, int begin, int end)
+		{
+			int* digits = &(offsets[chunk * RADIX_SIZE]);
+			std::fill(digits, digits + RADIX_SIZE, 0);
+			for (int i = begin; i < end; i++)
+			{
+				digits[(keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+			}
+		});
+
+		//digit totals and the offsets of each chunk run over groups of digits on the pool,
+		//only the scan over the totals is serial.
+		ThreadPool::Get().ParallelFor(RADIX_SIZE / DIGIT_GROUP, [&](int group)
+		{
+			for (int d = group * DIGIT_GROUP, end = d + DIGIT_GROUP; d < end; d++)
+			{
+				int sum = 0;
+				for (int c = 0; c < chunks; c++)
+				{
+					sum += offsets[c * RADIX_SIZE + d];
+				}
+				digitStart[d] = sum;
+			}
+		});
+
+		for (int d = 0, sum = 0; d < RADIX_SIZE; d++)
+		{
+			int digitCount = digitStart[d];
+			digitStart[d] = sum;
+			sum += digitCount;
+		}
+
+		ThreadPool::Get().ParallelFor(RADIX_SIZE / DIGIT_GROUP, [&](int group)
+		{
+			for (int d = group * DIGIT_GROUP, end = d + DIGIT_GROUP; d < end; d++)
+			{
+				int sum = digitStart[d];
+				for (int c = 0; c < chunks; c++)
+				{
+					int digitCount = offsets[c * RADIX_SIZE + d];
+					offsets[c * RADIX_SIZE + d] = sum;
+					sum += digitCount;
+				}
+			}
+		});
+
+		ForEachChunk(0, count, [&](int chunk, int begin, int end)
+		{
+			int* digits = &(offsets[chunk * RADIX_SIZE]);
+			for (int i = begin; i < end; i++)
+			{
+				sorted[digits[(keys[i] >> shift) & (RADIX_SIZE - 1)]++] = keys[i];
+			}
+		});
+		keys.swap(sorted);
+	}
+
+	mMortonCodes.resize(count);
+	ForEachChunk(0, count, [&](int, int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			mPrimitives[i] = static_cast<int>(keys[i] & 0xFFFFFFFFu);
+			mMortonCodes[i] = static_cast<unsigned int>(keys[i] >> 32);
+		}
+	});
+}
+
+int Bvh4::Split(int start, int count, int depth)
+{
+	if (depth > MEDIAN_DEPTH)
+	{
+		return SplitMedian(start, count);
+	}
+	return mMode == BvhBuild::Morton ? SplitMorton(start, count) : SplitSah(start, count);
+}
+
+int Bvh4::SplitMedian(int start, int count)
+{
+	int axis = LongestAxis(GetBounds(start, count, true));
+	int half = count / 2;
+	std::nth_element(mPrimitives.begin() + start, mPrimitives.begin() + start + half, mPrimitives.begin() + start + count,
+		[this, axis](int a, int b) { return mCentroids[a][axis] < mCentroids[b][axis]; });
+	return half;
+}
+
+int Bvh4::SplitSah(int start, int count)
+{
+	gml::aabb centroidAABB = GetBounds(start, count, true);
+	int axis = LongestAxis(centroidAABB);
+	gml::vec3 minBound = centroidAABB.min_bound();
+	gml::vec3 size = centroidAABB.max_bound() - minBound;
+	if (!(size[axis] > 0.0f))
+	{
+		return SplitMedian(start, count);
+	}
+
+	float origin = minBound[axis];
+	float scale = SAH_BIN_COUNT / size[axis];
+	auto binOf = [this, axis, origin, scale](int primitive)
+	{
+		int bin = static_cast<int>((mCentroids[primitive][axis] - origin) * scale);
+		return bin < SAH_BIN_COUNT ? bin : SAH_BIN_COUNT - 1;
+	};
+
+	std::vector<SahBin> partial(ChunkCount(count) * SAH_BIN_COUNT);
+	ForEachChunk(start, count, [&](int chunk, int begin, int end)
+	{
+		SahBin* bins = &(partial[chunk * SAH_BIN_COUNT]);
+		for (int i = begin; i < end; i++)
+		{
+			SahBin& bin = bins[binOf(mPrimitives[i])];
+			Merge(bin.Bounds, (*mBuildBounds)[mPrimitives[i]]);
+			bin.Count++;
+		}
+	});
+
+	SahBin bins[SAH_BIN_COUNT];
+	for (size_t i = 0; i < partial.size(); i++)
+	{
+		SahBin& bin = bins[i % SAH_BIN_COUNT];
+		if (partial[i].Count > 0)
+		{
+			Merge(bin.Bounds, partial[i].Bounds);
+			bin.Count += partial[i].Count;
+		}
+	}
+
+	//cost of splitting after bin b, swept from the right then from the left.
+	float rightCost[SAH_BIN_COUNT];
+	gml::aabb rightBounds;
+	int rightCount = 0;
+	for (int b = SAH_BIN_COUNT - 1; b > 0; b--)
+	{
+		if (bins[b].Count > 0)
+		{
+			Merge(rightBounds, bins[b].Bounds);
+			rightCount += bins[b].Count;
+		}
+		rightCost[b - 1] = rightCount > 0 ? HalfArea(rightBounds) * rightCount : 0.0f;
+	}
+
+	int bestSplit = -1;
+	float bestCost = FLT_MAX;
+	gml::aabb leftBounds;
+	int leftCount = 0;
+	for (int b = 0; b < SAH_BIN_COUNT - 1; b++)
+	{
+		if (bins[b].Count > 0)
+		{
+			Merge(leftBounds, bins[b].Bounds);
+			leftCount += bins[b].Count;
+		}
+		if (leftCount == 0 || leftCount == count)
+		{
+			continue;
+		}
+
+		float cost = HalfArea(leftBounds) * leftCount + rightCost[b];
+		if (cost < bestCost)
+		{
+			bestCost = cost;
+			bestSplit = b;
+		}
+	}
+
+	if (bestSplit < 0)
+	{
+		return SplitMedian(start, count);
+	}
+
+	auto middle = std::partition(mPrimitives.begin() + start, mPrimitives.begin() + start + count,
+		[&binOf, bestSplit](int primitive) { return binOf(primitive) <= bestSplit; });
+	return static_cast<int>(middle - (mPrimitives.begin() + start));
+}
+
+int Bvh4::SplitMorton(int start, int count)
+{
+	//split where the highest differing bit of the sorted codes flips.
+	unsigned int first = mMortonCodes[start];
+	unsigned int last = mMortonCodes[start + count - 1];
+	if (first == last)
+	{
+		return count / 2;
+	}
+
+	int bit = 31;
+	while (((first ^ last) >> bit) == 0)
+	{
+		bit--;
+	}
+
+	int low = start;
+	int high = start + count - 1;
+	while (low + 1 < high)
+	{
+		int middle = (low + high) / 2;
+		if ((mMortonCodes[middle] >> bit) & 1)
+		{
+			high = middle;
+		}
+		else
+		{
+			low = middle;
+		}
+	}
+	return high - start;
+}
+
+int Bvh4::BuildNode(int start, int count, int depth)
+{
+	int index = mNextNode++;
+
+	//keep halving the largest group, two levels of splits fill the four children.
+	int groupStart[4] = { start, 0, 0, 0 };
+	int groupCount[4] = { count, 0, 0, 0 };
+	int groups = 1;
+	while (groups < 4)
+	{
+		int widest = -1;
+		for (int g = 0; g < groups; g++)
+		{
+			if (groupCount[g] > mMaxLeafSize && (widest < 0 || groupCount[g] > groupCount[widest]))
+			{
+				widest = g;
+			}
+		}
+		if (widest < 0)
+		{
+			break;
+		}
+
+		int half = Split(groupStart[widest], groupCount[widest], depth);
+		groupStart[groups] = groupStart[widest] + half;
+		groupCount[groups] = groupCount[widest] - half;
+		groupCount[widest] = half;
+		groups++;
+	}
+
+	Node node;
+	int inner[4];
+	int innerCount = 0;
+	for (int c = 0; c < 4; c++)
+	{
+		if (c >= groups)
+		{
+			//inverted box, never passes the slab test.
+			for (int axis = 0; axis < 3; axis++)
+			{
+				node.Bounds[0][axis][c] = FLT_MAX;
+				node.Bounds[1][axis][c] = -FLT_MAX;
+			}
+			node.Child[c] = 0;
+			node.Count[c] = -1;
+			continue;
+		}
+
+		gml::aabb aabb = GetBounds(groupStart[c], groupCount[c], false);
+		gml::vec3 minBound = aabb.min_bound();
+		gml::vec3 maxBound = aabb.max_bound();
+		for (int axis = 0; axis < 3; axis++)
+		{
+			node.Bounds[0][axis][c] = minBound[axis];
+			node.Bounds[1][axis][c] = maxBound[axis];
+		}
+
+		if (groupCount[c] <= mMaxLeafSize)
+		{
+			node.Child[c] = groupStart[c];
+			node.Count[c] = groupCount[c];
+		}
+		else
+		{
+			node.Count[c] = 0;
+			inner[innerCount++] = c;
+		}
+	}
+
+	//subtrees own disjoint primitive ranges and node slots, large ones build as pool tasks.
+	auto buildChild = [&](int i)
+	{
+		int c = inner[i];
+		node.Child[c] = BuildNode(groupStart[c], groupCount[c], depth + 1);
+	};
+	if (count >= PARALLEL_CHUNK)
+	{
+		ThreadPool::Get().ParallelFor(innerCount, buildChild);
+	}
+	else
+	{
+		for (int i = 0; i < innerCount; i++)
+		{
+			buildChild(i);
+		}
+	}
+
+	mNodes[index] = node;
+	return index;
+}
+
+void Bvh4Accelerator::SplitObjects(const std::vector<ISceneObject*>& objects)
+{
+	mObjects.clear();
+	mUnbounded.clear();
+	for (ISceneObject* object : objects)
+	{
+		if (IsBounded(object->GetAABB()))
+		{
+			mObjects.push_back(object);
+		}
+		else
+		{
+			mUnbounded.push_back(object);
+		}
+	}
+}
+
+void Bvh4Accelerator::Build(const std::vector<ISceneObject*>& objects)
+{
+	SplitObjects(objects);
+
+	std::vector<gml::aabb> bounds(mObjects.size());
+	for (size_t i = 0; i < mObjects.size(); i++)
+	{
+		bounds[i] = mObjects[i]->GetAABB();
+	}
+
+	//objects only move between frames, the fast linear build is enough for rebuilds.
+	mBvh.Build(bounds, MAX_LEAF_OBJECTS, mBuilt ? BvhBuild::Morton : BvhBuild::Sah);
+	mBuilt = true;
+}
+
+bool Bvh4Accelerator::Attach(const std::vector<ISceneObject*>& objects, const void* nodes, int nodeCount, const int* primitives, int primitiveCount)
+{
+	SplitObjects(objects);
+	for (int i = 0; i < primitiveCount; i++)
+	{
+		if (primitives[i] < 0 || primitives[i] >= static_cast<int>(mObjects.size()))
+		{
+			return false;
+		}
+	}
+
+	mBuilt = true;
+	return mBvh.Attach(nodes, nodeCount, primitives, primitiveCount);
+}
+
+ISceneObject* Bvh4Accelerator::IntersectWithRay(const gml::ray& ray, HitInfo& info, ISceneObject* exclude) const
+{
+	ISceneObject* hitObject = nullptr;
+	for (ISceneObject* object : mUnbounded)
+	{
+		if (object != exclude && object->IntersectWithRay(ray, info.t, info))
+		{
+			hitObject = object;
+		}
+	}
+
+	float maxt = info.t;
+	mBvh.Traverse(ray, maxt, [&](int primitive, float& mint)
+	{
+		ISceneObject* object = mObjects[primitive];
+		if (object != exclude && object->IntersectWithRay(ray, mint, info))
+		{
+			mint = info.t;
+			hitObject = object;
+			return true;
+		}
+		return false;
+	});
+
+	return hitObject;
+}
+
+bool Bvh4Accelerator::QueryObjects(const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count) const
+{
+	for (ISceneObject* object : mUnbounded)
+	{
+		if (!AddQueryObject(object, filter, objects, maxCount, count))
+		{
+			return false;
+		}
+	}
+
+	return mBvh.Query([&filter](const gml::aabb& aabb) { return filter.Overlaps(aabb); },
+		[&](int primitive) { return AddQueryObject(mObjects[primitive], filter, objects, maxCount, count); });
+}
@@ -0,0 +1,255 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <assert.h>
+#include <xmmintrin.h>
+#include <gmlaabb.h>
+#include <gmlray.h>
+#include "accelerator.h"
+
+//ray data shared by every node test of one traversal.
+struct RayContext
+{
+	RayContext(const gml::ray& ray);
+
+	__m128 Origin[3];
+	__m128 InvDir[3];
+	int Sign[3];	//1 when the direction is negative on the axis
+};
+
+enum class BvhBuild
+{
+	Sah,		//binned surface area heuristic, best trees for static geometry
+	Morton,		//linear bvh from sorted morton codes, fast rebuilds
+};
+
+//four-wide bvh over primitive bounds. child boxes are stored per axis,
+//so a single sse slab test covers the four children of a node.
+class Bvh4
+{
+public:
+	//large ranges are split across the shared thread pool.
+	void Build(const std::vector<gml::aabb>& bounds, int maxLeafSize, BvhBuild mode = BvhBuild::Sah);
+
+	//uses nodes and primitive ids stored elsewhere in place, false when they do not form a valid tree
+	//or one deeper than MAX_DEPTH.
+	bool Attach(const void* nodes, int nodeCount, const int* primitives, int primitiveCount);
+
+	inline bool IsEmpty() const { return mNodeCount == 0; }
+
+	inline const void* GetNodes() const { return mNodeData; }
+	inline int GetNodeCount() const { return mNodeCount; }
+	inline const int* GetPrimitives() const { return mPrimitiveData; }
+	inline int GetPrimitiveCount() const { return mPrimitiveCount; }
+	static int GetNodeSize() { return sizeof(Node); }
+
+	//leaf(primitive, maxt) returns true on a closer hit, after shrinking maxt.
+	template<typename LeafFunc>
+	bool Traverse(const gml::ray& ray, float& maxt, LeafFunc leaf) const;
+
+	//visits the primitives of every leaf whose box passes overlaps(aabb), leaf(primitive)
+	//returns false to stop. false when stopped.
+	template<typename BoundsFunc, typename LeafFunc>
+	bool Query(BoundsFunc overlaps, LeafFunc leaf) const;
+
+private:
+	//levels of inner nodes. sah splits may peel off single primitives, so below MEDIAN_DEPTH
+	//the build switches to median splits, which quarter the primitives of every level.
+	static const int MAX_DEPTH = 48;
+	static const int MEDIAN_DEPTH = MAX_DEPTH - 16;
+
+	//each visit pops one entry and pushes at most four, so the stack grows by three per level.
+	static const int MAX_STACK = 3 * MAX_DEPTH + 1;
+
+	struct Node
+	{
+		float Bounds[2][3][4];	//[min, max][axis][child]
+		int Child[4];	//inner node index, or first primitive of a leaf
+		int Count[4];	//primitives of a leaf, 0 for inner node, -1 for empty slot
+	};
+
+	struct StackEntry
+	{
+		int Child;
+		int Count;
+		float Entry;
+	};
+
+	int BuildNode(int start, int count, int depth);
+	int Split(int start, int count, int depth);
+	int SplitMedian(int start, int count);
+	int SplitSah(int start, int count);
+	int SplitMorton(int start, int count);
+	void SortMorton();
+	gml::aabb GetBounds(int start, int count, bool centroids) const;
+	int IntersectChildren(const Node& node, const RayContext& context, float maxt, float entries[4]) const;
+
+	int mMaxLeafSize = 4;
+	std::vector<Node> mNodes;
+	std::vector<int> mPrimitives;
+
+	//either the vectors above or attached external storage.
+	const Node* mNodeData = nullptr;
+	const int* mPrimitiveData = nullptr;
+	int mNodeCount = 0;
+	int mPrimitiveCount = 0;
+
+	//build-time only
+	BvhBuild mMode = BvhBuild::Sah;
+	const std::vector<gml::aabb>* mBuildBounds = nullptr;
+	std::vector<gml::vec3> mCentroids;
+	std::vector<unsigned int> mMortonCodes;
+	std::atomic<int> mNextNode;
+};
+
+class Bvh4Accelerator : public Accelerator
+{
+public:
+	virtual void Build(const std::vector<ISceneObject*>& objects);
+
+	virtual ISceneObject* IntersectWithRay(const gml::ray& ray, HitInfo& info, ISceneObject* exclude) const;
+
+	virtual bool QueryObjects(const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count) const;
+
+	//prebuilt tree over the bounded objects, in the order they appear in objects.
+	bool Attach(const std::vector<ISceneObject*>& objects, const void* nodes, int nodeCount, const int* primitives, int primitiveCount);
+
+	inline const Bvh4& GetBvh() const { return mBvh; }
+
+private:
+	void SplitObjects(const std::vector<ISceneObject*>& objects);
+
+	Bvh4 mBvh;
+	bool mBuilt = false;
+	std::vector<ISceneObject*> mObjects;
+	std::vector<ISceneObject*> mUnbounded;
+};
+
+inline int Bvh4::IntersectChildren(const Node& node, const RayContext& context, float maxt, float entries[4]) const
+{
+	//nan from a zero direction on a slab plane keeps the running bound, max/min return the second operand.
+	__m128 tNear = _mm_setzero_ps();
+	__m128 tFar = _mm_set1_ps(maxt);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		__m128 nearPlane = _mm_loadu_ps(node.Bounds[context.Sign[axis]][axis]);
+		__m128 farPlane = _mm_loadu_ps(node.Bounds[1 - context.Sign[axis]][axis]);
+		tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(nearPlane, context.Origin[axis]), context.InvDir[axis]), tNear);
+		tFar = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(farPlane, context.Origin[axis]), context.InvDir[axis]), tFar);
+	}
+	_mm_storeu_ps(entries, tNear);
+	return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+}
+
+template<typename LeafFunc>
+bool Bvh4::Traverse(const gml::ray& ray, float& maxt, LeafFunc leaf) const
+{
+	if (mNodeCount == 0)
+	{
+		return false;
+	}
+
+	StackEntry stack[MAX_STACK];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, 0, 0.0f };
+
+	RayContext context(ray);
+	bool found = false;
+	while (stackSize > 0)
+	{
+		StackEntry top = stack[--stackSize];
+		if (top.Entry > maxt)
+		{
+			continue;
+		}
+
+		if (top.Count > 0)
+		{
+			for (int i = top.Child, end = top.Child + top.Count; i < end; i++)
+			{
+				if (leaf(mPrimitiveData[i], maxt))
+				{
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		const Node& node = mNodeData[top.Child];
+		float entries[4];
+		int mask = IntersectChildren(node, context, maxt, entries);
+
+		//far children are pushed first, so the nearest one is popped next.
+		int order[4];
+		int count = 0;
+		for (int c = 0; c < 4; c++)
+		{
+			if (mask & (1 << c))
+			{
+				int i = count++;
+				for (; i > 0 && entries[order[i - 1]] < entries[c]; i--)
+				{
+					order[i] = order[i - 1];
+				}
+				order[i] = c;
+			}
+		}
+
+		assert(stackSize + count <= MAX_STACK);
+		for (int i = 0; i < count; i++)
+		{
+			int c = order[i];
+			stack[stackSize++] = { node.Child[c], node.Count[c], entries[c] };
+		}
+	}
+
+	return found;
+}
+
+template<typename BoundsFunc, typename LeafFunc>
+bool Bvh4::Query(BoundsFunc overlaps, LeafFunc leaf) const
+{
+	if (mNodeCount == 0)
+	{
+		return true;
+	}
+
+	int stack[MAX_STACK];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const Node& node = mNodeData[stack[--stackSize]];
+		for (int c = 0; c < 4; c++)
+		{
+			if (node.Count[c] < 0)
+			{
+				continue;
+			}
+
+			gml::aabb aabb;
+			aabb.expand(gml::vec3(node.Bounds[0][0][c], node.Bounds[0][1][c], node.Bounds[0][2][c]));
+			aabb.expand(gml::vec3(node.Bounds[1][0][c], node.Bounds[1][1][c], node.Bounds[1][2][c]));
+			if (!overlaps(aabb))
+			{
+				continue;
+			}
+
+			if (node.Count[c] == 0)
+			{
+				assert(stackSize < MAX_STACK);
+				stack[stackSize++] = node.Child[c];
+				continue;
+			}
+
+			for (int i = node.Child[c], end = node.Child[c] + node.Count[c]; i < end; i++)
+			{
+				if (!leaf(mPrimitiveData[i]))
+				{
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
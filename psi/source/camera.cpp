@@ -3,27 +3,60 @@
 #include "camera.h"
 
 Camera::Camera()
+	: mRight(1, 0, 0)
+	, mUp(0, 1, 0)
+	, mBack(0, 0, 1)
 {
 	SetFOV(30);
 }
 
-gml::ray Camera::GenerateRay(int width, int height, int x, int y)
+gml::ray Camera::GenerateRay(int width, int height, int x, int y) const
 {
 	float pixelX = x + 0.5f;	//ϰصĿ
 	float pixelY = y + 0.5f;	//ϰصĿ
 
+	gml::ray ray;
+	ray.set_dir(GetDirection(width, height, pixelX, pixelY));
+	ray.set_origin(mPosition);
+	return ray;
+}
+
+gml::vec3 Camera::GetDirection(int width, int height, float x, float y) const
+{
 	float widthInv = 1.0f / width;
 	float heightInv = 1.0f / height;
 
 	float aspect = width * heightInv;
 	
-	float xReal = pixelX * widthInv * 2.0f - 1.0f;
-	float yReal = pixelY * heightInv * 2.0f - 1.0f;
+	float xReal = x * widthInv * 2.0f - 1.0f;
+	float yReal = y * heightInv * 2.0f - 1.0f;
 
-	gml::ray ray;
-	ray.set_dir(gml::vec3(xReal * aspect * mTangentFOV, yReal  * mTangentFOV, -1).normalized());
-	ray.set_origin(mPosition);
-	return ray;
+	return (mRight * (xReal * aspect * mTangentFOV) + mUp * (yReal * mTangentFOV) - mBack).normalized();
+}
+
+void Camera::LookAt(const gml::vec3& target, const gml::vec3& up)
+{
+	gml::vec3 back = mPosition - target;
+	if (back.length_sqr() == 0.0f)
+	{
+		return;
+	}
+	back = back.normalized();
+
+	//looking straight up or down, any horizontal right vector will do.
+	gml::vec3 right = cross(up, back);
+	if (right.length_sqr() < 1e-12f)
+	{
+		right = cross(gml::vec3(0, 0, 1), back);
+		if (right.length_sqr() < 1e-12f)
+		{
+			right = cross(gml::vec3(1, 0, 0), back);
+		}
+	}
+
+	mBack = back;
+	mRight = right.normalized();
+	mUp = cross(mBack, mRight);
 }
 
 void Camera::SetPosition(float x, float y, float z)
@@ -10,12 +10,20 @@ public:
 
 	void SetFOV(float angle);
 
-	gml::ray GenerateRay(int w, int h, int x, int y);
+	//orients the camera from its position towards target, up only has to be roughly up.
+	void LookAt(const gml::vec3& target, const gml::vec3& up);
+
+	gml::ray GenerateRay(int w, int h, int x, int y) const;
+
+	gml::vec3 GetDirection(int w, int h, float x, float y) const;
 
 	inline const gml::vec3& GetPosition() const { return mPosition; }
 
 private:
 	gml::vec3 mPosition;
+	gml::vec3 mRight;
+	gml::vec3 mUp;
+	gml::vec3 mBack;	//the camera looks along -mBack
 
 	float mFOV;
 	float mTangentFOV;
@@ -1,5 +1,6 @@
 #include "pch.h"
 #include <math.h>
+#include <float.h>
 #include <gmlray.h>
 #include <gmlaabb.h>
 #include "geometry.h"
@@ -125,7 +126,7 @@ int IntersectPlaneWithRay(const gml::ray& ray, const gml::vec3& P0, const gml::v
 	return (t0 >= 0.0f) ? 1 : 0;
 }
 
-int IntersectTriangleWithRay(const gml::ray& ray, const gml::vec3& v0, const gml::vec3& v1, const gml::vec3& v2, float& t, float&u, float& v, gml::vec3& normal)
+int IntersectTriangleWithRay(const gml::ray& ray, const gml::vec3& v0, const gml::vec3& v1, const gml::vec3& v2, float& t, float&u, float& v)
 {
 	//moller-trumbore
 
@@ -161,11 +162,15 @@ int IntersectTriangleWithRay(const gml::ray& ray, const gml::vec3& v0, const gml
 		return 0;
 	}
 
-	normal = cross(v2v0, v1v0).normalized();
 	return 1;
 
 }
 
+gml::vec3 GetTriangleNormal(const gml::vec3& v0, const gml::vec3& v1, const gml::vec3& v2)
+{
+	return cross(v2 - v0, v1 - v0).normalized();
+}
+
 int Intersect(const gml::ray& ray, const Sphere& sphere, float& t0, float& t1)
 {
 	gml::vec3 CO = sphere.GetCenter() - ray.origin();
@@ -358,4 +363,61 @@ int Intersect(const gml::ray& ray, const gml::aabb& aabb)
 	if (tMaxZ < tMax)		tMax = tMaxZ;
 
 	return true;
+}
+
+namespace
+{
+	inline bool ClipSlab(float minBound, float maxBound, float origin, float invDir, float& tMin, float& tMax)
+	{
+		float tNear = (minBound - origin) * invDir;
+		float tFar = (maxBound - origin) * invDir;
+		if (tNear > tFar)
+		{
+			float t = tNear;
+			tNear = tFar;
+			tFar = t;
+		}
+
+		if (tNear > tMin)	tMin = tNear;
+		if (tFar < tMax)	tMax = tFar;
+		return tMin <= tMax;
+	}
+}
+
+int Intersect(const gml::ray& ray, const gml::vec3& invDir, const gml::aabb& aabb, float maxt, float& t0)
+{
+	float t1;
+	return Intersect(ray, invDir, aabb, maxt, t0, t1);
+}
+
+int Intersect(const gml::ray& ray, const gml::vec3& invDir, const gml::aabb& aabb, float maxt, float& t0, float& t1)
+{
+	//boxes behind the origin or beyond maxt are rejected.
+	float tMin = 0.0f;
+	float tMax = maxt;
+	const gml::vec3& origin = ray.origin();
+	if (ClipSlab(aabb.min_bound().x, aabb.max_bound().x, origin.x, invDir.x, tMin, tMax) &&
+		ClipSlab(aabb.min_bound().y, aabb.max_bound().y, origin.y, invDir.y, tMin, tMax) &&
+		ClipSlab(aabb.min_bound().z, aabb.max_bound().z, origin.z, invDir.z, tMin, tMax))
+	{
+		t0 = tMin;
+		t1 = tMax;
+		return 1;
+	}
+	return 0;
+}
+
+bool IsBounded(const gml::aabb& aabb)
+{
+	const gml::vec3& minBound = aabb.min_bound();
+	const gml::vec3& maxBound = aabb.max_bound();
+	return minBound.x > -FLT_MAX && minBound.y > -FLT_MAX && minBound.z > -FLT_MAX &&
+		maxBound.x < FLT_MAX && maxBound.y < FLT_MAX && maxBound.z < FLT_MAX;
+}
+
+bool IsOverlapped(const gml::aabb& a, const gml::aabb& b)
+{
+	return a.min_bound().x <= b.max_bound().x && a.max_bound().x >= b.min_bound().x &&
+		a.min_bound().y <= b.max_bound().y && a.max_bound().y >= b.min_bound().y &&
+		a.min_bound().z <= b.max_bound().z && a.max_bound().z >= b.min_bound().z;
 }
\ No newline at end of file
@@ -85,8 +85,13 @@ private:
 };
 
 int IntersectPlaneWithRay(const gml::ray& ray, const gml::vec3& pV0, const gml::vec3& pNormal, bool dualFace, float& t0);
-int IntersectTriangleWithRay(const gml::ray& ray, const gml::vec3& v0, const gml::vec3& v1, const gml::vec3& v2, float& t, float&u, float& v, gml::vec3& normal);
+int IntersectTriangleWithRay(const gml::ray& ray, const gml::vec3& v0, const gml::vec3& v1, const gml::vec3& v2, float& t, float&u, float& v);
+gml::vec3 GetTriangleNormal(const gml::vec3& v0, const gml::vec3& v1, const gml::vec3& v2);
 int Intersect(const gml::ray& ray, const Sphere& sphere, float& t0, float& t1);
 int Intersect(const gml::ray& ray, const Plane& plane, float& t0);
 int Intersect(const gml::ray& ray, const Box& box, float& t0, float& t1);
 int Intersect(const gml::ray& ray, const gml::aabb& aabb);
+int Intersect(const gml::ray& ray, const gml::vec3& invDir, const gml::aabb& aabb, float maxt, float& t0);
+int Intersect(const gml::ray& ray, const gml::vec3& invDir, const gml::aabb& aabb, float maxt, float& t0, float& t1);
+bool IsBounded(const gml::aabb& aabb);
+bool IsOverlapped(const gml::aabb& a, const gml::aabb& b);
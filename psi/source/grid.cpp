@@ -0,0 +1,326 @@
+#include "pch.h"
+#include <math.h>
+#include <float.h>
+#include "grid.h"
+#include "geometry.h"
+#include "threadpool.h"
+
+namespace
+{
+	//cells per bounded object, keeps a few objects in each occupied cell.
+	const float GRID_DENSITY = 4.0f;
+	const int MAX_GRID_RESOLUTION = 128;
+	const int PARALLEL_BUILD_THRESHOLD = 1024;
+
+	int Clamp(int value, int minValue, int maxValue)
+	{
+		return value < minValue ? minValue : (value > maxValue ? maxValue : value);
+	}
+
+	template<typename Function>
+	void ParallelRange(int count, const Function& function)
+	{
+		ThreadPool& pool = ThreadPool::Get();
+		int threadCount = pool.GetThreadCount();
+		if (count < PARALLEL_BUILD_THRESHOLD || threadCount <= 1)
+		{
+			function(0, count);
+			return;
+		}
+
+		int segment = (count + threadCount - 1) / threadCount;
+		pool.ParallelFor(threadCount, [&](int i)
+		{
+			int start = i * segment;
+			int end = (start + segment < count) ? start + segment : count;
+			if (start < end)
+			{
+				function(start, end);
+			}
+		});
+	}
+}
+
+void Grid::Build(const std::vector<ISceneObject*>& objects)
+{
+	mUnbounded.clear();
+	mAABB = gml::aabb();
+	int boundedCount = 0;
+	for (ISceneObject* obj : objects)
+	{
+		const gml::aabb& aabb = obj->GetAABB();
+		if (IsBounded(aabb))
+		{
+			mAABB.expand(aabb.min_bound());
+			mAABB.expand(aabb.max_bound());
+			boundedCount++;
+		}
+		else
+		{
+			mUnbounded.push_back(obj);
+		}
+	}
+
+	mCellStart.assign(1, 0);
+	mCellObjects.clear();
+	mCellCount = 0;
+	if (boundedCount == 0)
+	{
+		return;
+	}
+
+	//resolution follows object density, cells stay roughly cubic.
+	const float EPSILON = 1e-4f;
+	gml::vec3 minBound = mAABB.min_bound();
+	gml::vec3 size = mAABB.max_bound() - minBound;
+	float volume = 1.0f;
+	for (int i = 0; i < 3; i++)
+	{
+		if (size[i] < EPSILON)
+		{
+			size[i] = EPSILON;
+		}
+		volume *= size[i];
+	}
+
+	float cellsPerUnit = static_cast<float>(pow(GRID_DENSITY * boundedCount / volume, 1.0 / 3.0));
+	mCellCount = 1;
+	for (int i = 0; i < 3; i++)
+	{
+		mResolution[i] = Clamp(static_cast<int>(size[i] * cellsPerUnit), 1, MAX_GRID_RESOLUTION);
+		mMinBound[i] = minBound[i];
+		mCellSize[i] = size[i] / mResolution[i];
+		mInvCellSize[i] = 1.0f / mCellSize[i];
+		mCellCount *= mResolution[i];
+	}
+
+	if (mCellCapacity < mCellCount)
+	{
+		mCellCapacity = mCellCount;
+		mCellCursor.reset(new std::atomic<int>[mCellCapacity]);
+	}
+	for (int c = 0; c < mCellCount; c++)
+	{
+		mCellCursor[c] = 0;
+	}
+
+	//counting sort: count references per cell, prefix sum, then scatter.
+	int objectCount = static_cast<int>(objects.size());
+	ParallelRange(objectCount, [this, &objects](int start, int end) { CountObjects(objects, start, end); });
+
+	mCellStart.resize(mCellCount + 1);
+	for (int c = 0; c < mCellCount; c++)
+	{
+		int count = mCellCursor[c];
+		mCellCursor[c] = mCellStart[c];
+		mCellStart[c + 1] = mCellStart[c] + count;
+	}
+
+	mCellObjects.resize(mCellStart[mCellCount]);
+	ParallelRange(objectCount, [this, &objects](int start, int end) { FillObjects(objects, start, end); });
+}
+
+void Grid::GetCellRange(const gml::aabb& aabb, int cellMin[3], int cellMax[3]) const
+{
+	gml::vec3 minBound = aabb.min_bound();
+	gml::vec3 maxBound = aabb.max_bound();
+	for (int i = 0; i < 3; i++)
+	{
+		cellMin[i] = Clamp(static_cast<int>((minBound[i] - mMinBound[i]) * mInvCellSize[i]), 0, mResolution[i] - 1);
+		cellMax[i] = Clamp(static_cast<int>((maxBound[i] - mMinBound[i]) * mInvCellSize[i]), 0, mResolution[i] - 1);
+	}
+}
+
+void Grid::CountObjects(const std::vector<ISceneObject*>& objects, int start, int end)
+{
+	int cellMin[3], cellMax[3];
+	for (int i = start; i < end; i++)
+	{
+		const gml::aabb& aabb = objects[i]->GetAABB();
+		if (!IsBounded(aabb))
+		{
+			continue;
+		}
+
+		GetCellRange(aabb, cellMin, cellMax);
+		for (int z = cellMin[2]; z <= cellMax[2]; z++)
+			for (int y = cellMin[1]; y <= cellMax[1]; y++)
+				for (int x = cellMin[0]; x <= cellMax[0]; x++)
+				{
+					mCellCursor[x + mResolution[0] * (y + mResolution[1] * z)]++;
+				}
+	}
+}
+
+void Grid::FillObjects(const std::vector<ISceneObject*>& objects, int start, int end)
+{
+	int cellMin[3], cellMax[3];
+	for (int i = start; i < end; i++)
+	{
+		const gml::aabb& aabb = objects[i]->GetAABB();
+		if (!IsBounded(aabb))
+		{
+			continue;
+		}
+
+		GetCellRange(aabb, cellMin, cellMax);
+		for (int z = cellMin[2]; z <= cellMax[2]; z++)
+			for (int y = cellMin[1]; y <= cellMax[1]; y++)
+				for (int x = cellMin[0]; x <= cellMax[0]; x++)
+				{
+					int index = mCellCursor[x + mResolution[0] * (y + mResolution[1] * z)]++;
+					mCellObjects[index] = objects[i];
+				}
+	}
+}
+
+ISceneObject* Grid::IntersectWithRay(const gml::ray& ray, HitInfo& info, ISceneObject* exclude) const
+{
+	ISceneObject* hitObject = nullptr;
+	for (int i = 0, length = mUnbounded.size(); i < length; ++i)
+	{
+		ISceneObject* object = mUnbounded[i];
+		if (object != exclude && object->IntersectWithRay(ray, info.t, info))
+		{
+			hitObject = object;
+		}
+	}
+
+	gml::vec3 invDir = ray.direction().inversed();
+	float tEnter, tExit;
+	if (mCellCount == 0 || !Intersect(ray, invDir, mAABB, info.t, tEnter, tExit))
+	{
+		return hitObject;
+	}
+
+	//3d-dda, Amanatides & Woo.
+	gml::vec3 origin = ray.origin();
+	gml::vec3 direction = ray.direction();
+	int cell[3], step[3], out[3];
+	float tNext[3], tDelta[3];
+	for (int i = 0; i < 3; i++)
+	{
+		float position = origin[i] + direction[i] * tEnter;
+		cell[i] = Clamp(static_cast<int>((position - mMinBound[i]) * mInvCellSize[i]), 0, mResolution[i] - 1);
+		if (direction[i] > 0.0f)
+		{
+			step[i] = 1;
+			out[i] = mResolution[i];
+			tNext[i] = (mMinBound[i] + (cell[i] + 1) * mCellSize[i] - origin[i]) * invDir[i];
+			tDelta[i] = mCellSize[i] * invDir[i];
+		}
+		else if (direction[i] < 0.0f)
+		{
+			step[i] = -1;
+			out[i] = -1;
+			tNext[i] = (mMinBound[i] + cell[i] * mCellSize[i] - origin[i]) * invDir[i];
+			tDelta[i] = -mCellSize[i] * invDir[i];
+		}
+		else
+		{
+			step[i] = 0;
+			out[i] = -1;
+			tNext[i] = FLT_MAX;
+			tDelta[i] = FLT_MAX;
+		}
+	}
+
+	while (true)
+	{
+		int c = cell[0] + mResolution[0] * (cell[1] + mResolution[1] * cell[2]);
+		for (int i = mCellStart[c], end = mCellStart[c + 1]; i < end; i++)
+		{
+			ISceneObject* object = mCellObjects[i];
+			if (object != exclude && object->IntersectWithRay(ray, info.t, info))
+			{
+				hitObject = object;
+			}
+		}
+
+		int axis = (tNext[0] < tNext[1]) ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+
+		//nothing in the following cells can beat a hit before this cell's exit.
+		if (info.t <= tNext[axis] || tNext[axis] > tExit)
+		{
+			break;
+		}
+
+		cell[axis] += step[axis];
+		if (cell[axis] == out[axis])
+		{
+			break;
+		}
+		tNext[axis] += tDelta[axis];
+	}
+
+	return hitObject;
+}
+
+bool Grid::QueryObjects(const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count) const
+{
+	for (ISceneObject* object : mUnbounded)
+	{
+		if (!AddQueryObject(object, filter, objects, maxCount, count))
+		{
+			return false;
+		}
+	}
+
+	if (mCellCount == 0)
+	{
+		return true;
+	}
+
+	int cellMin[3] = { 0, 0, 0 };
+	int cellMax[3] = { mResolution[0] - 1, mResolution[1] - 1, mResolution[2] - 1 };
+	return QueryCells(filter, cellMin, cellMax, objects, maxCount, count);
+}
+
+//halves the cell range along its longest axis, ranges outside the filter are skipped as a whole.
+bool Grid::QueryCells(const IBoundsFilter& filter, const int cellMin[3], const int cellMax[3], ISceneObject** objects, int maxCount, int& count) const
+{
+	gml::aabb aabb;
+	aabb.expand(gml::vec3(
+		mMinBound[0] + cellMin[0] * mCellSize[0],
+		mMinBound[1] + cellMin[1] * mCellSize[1],
+		mMinBound[2] + cellMin[2] * mCellSize[2]));
+	aabb.expand(gml::vec3(
+		mMinBound[0] + (cellMax[0] + 1) * mCellSize[0],
+		mMinBound[1] + (cellMax[1] + 1) * mCellSize[1],
+		mMinBound[2] + (cellMax[2] + 1) * mCellSize[2]));
+	if (!filter.Overlaps(aabb))
+	{
+		return true;
+	}
+
+	int extent[3] = { cellMax[0] - cellMin[0], cellMax[1] - cellMin[1], cellMax[2] - cellMin[2] };
+	int axis = (extent[0] > extent[1]) ? (extent[0] > extent[2] ? 0 : 2) : (extent[1] > extent[2] ? 1 : 2);
+	if (extent[axis] == 0)
+	{
+		int c = cellMin[0] + mResolution[0] * (cellMin[1] + mResolution[1] * cellMin[2]);
+		for (int i = mCellStart[c], end = mCellStart[c + 1]; i < end; i++)
+		{
+			//objects spanning several cells are met more than once.
+			ISceneObject* object = mCellObjects[i];
+			bool found = false;
+			for (int j = 0; j < count && !found; j++)
+			{
+				found = objects[j] == object;
+			}
+
+			if (!found && !AddQueryObject(object, filter, objects, maxCount, count))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	int half = cellMin[axis] + extent[axis] / 2;
+	int lowMax[3] = { cellMax[0], cellMax[1], cellMax[2] };
+	int highMin[3] = { cellMin[0], cellMin[1], cellMin[2] };
+	lowMax[axis] = half;
+	highMin[axis] = half + 1;
+	return QueryCells(filter, cellMin, lowMax, objects, maxCount, count) &&
+		QueryCells(filter, highMin, cellMax, objects, maxCount, count);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <memory>
+#include "accelerator.h"
+
+class Grid : public Accelerator
+{
+public:
+	virtual void Build(const std::vector<ISceneObject*>& objects);
+
+	virtual ISceneObject* IntersectWithRay(const gml::ray& ray, HitInfo& info, ISceneObject* exclude) const;
+
+	virtual bool QueryObjects(const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count) const;
+
+private:
+	void GetCellRange(const gml::aabb& aabb, int cellMin[3], int cellMax[3]) const;
+	bool QueryCells(const IBoundsFilter& filter, const int cellMin[3], const int cellMax[3], ISceneObject** objects, int maxCount, int& count) const;
+	void CountObjects(const std::vector<ISceneObject*>& objects, int start, int end);
+	void FillObjects(const std::vector<ISceneObject*>& objects, int start, int end);
+
+	gml::aabb mAABB;
+	float mMinBound[3];
+	float mCellSize[3];
+	float mInvCellSize[3];
+	int mResolution[3] = { 0, 0, 0 };
+	int mCellCount = 0;
+
+	//cell c owns mCellObjects[mCellStart[c], mCellStart[c + 1])
+	std::vector<int> mCellStart;
+	std::vector<ISceneObject*> mCellObjects;
+	std::vector<ISceneObject*> mUnbounded;
+
+	int mCellCapacity = 0;
+	std::unique_ptr<std::atomic<int>[]> mCellCursor;
+};
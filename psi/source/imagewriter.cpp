@@ -0,0 +1,147 @@
+#include "pch.h"
+#include <stdio.h>
+#include "imagewriter.h"
+
+ImageWriter::~ImageWriter()
+{
+	Close();
+}
+
+bool ImageWriter::Open(ImageFormat format, const char* path, int width, int height, int frameRate, int maxQueued)
+{
+	if (path == nullptr || width <= 0 || height <= 0 || mThread.joinable())
+	{
+		return false;
+	}
+
+	mFormat = format;
+	mPath = path;
+	mWidth = width;
+	mHeight = height;
+	mMaxQueued = maxQueued > 0 ? maxQueued : 1;
+	mClosing = false;
+	mFailed = false;
+
+	if (format == ImageFormat::Y4m)
+	{
+		mStream.open(path, std::ios::binary);
+		if (!mStream)
+		{
+			return false;
+		}
+
+		char header[64];
+		snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, frameRate);
+		mStream << header;
+		mPlanes.resize(width * height * 3);
+	}
+
+	mThread = std::thread(&ImageWriter::WriterLoop, this);
+	return true;
+}
+
+std::vector<unsigned char> ImageWriter::Acquire()
+{
+	std::vector<unsigned char> image;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!mFree.empty())
+		{
+			image.swap(mFree.back());
+			mFree.pop_back();
+		}
+	}
+	image.resize(mWidth * mHeight * 3);
+	return image;
+}
+
+void ImageWriter::Push(int frame, std::vector<unsigned char>&& image)
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mChanged.wait(lock, [this] { return static_cast<int>(mQueue.size()) < mMaxQueued; });
+	mQueue.push_back({ frame, std::move(image) });
+	mChanged.notify_all();
+}
+
+bool ImageWriter::Close()
+{
+	if (mThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mClosing = true;
+		}
+		mChanged.notify_all();
+		mThread.join();
+	}
+
+	if (mStream.is_open())
+	{
+		mStream.close();
+		if (mStream.fail())
+		{
+			mFailed = true;
+		}
+	}
+	return !mFailed;
+}
+
+void ImageWriter::WriterLoop()
+{
+	while (true)
+	{
+		Frame frame;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mChanged.wait(lock, [this] { return mClosing || !mQueue.empty(); });
+			if (mQueue.empty())
+			{
+				return;
+			}
+			frame = std::move(mQueue.front());
+			mQueue.pop_front();
+		}
+		mChanged.notify_all();
+
+		//encoding runs outside the lock, rendering keeps pushing meanwhile.
+		bool written = WriteFrame(frame);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mFailed = mFailed || !written;
+		mFree.push_back(std::move(frame.Image));
+	}
+}
+
+bool ImageWriter::WriteFrame(const Frame& frame)
+{
+	const unsigned char* rgb = frame.Image.data();
+	int pixelCount = mWidth * mHeight;
+
+	if (mFormat == ImageFormat::Ppm)
+	{
+		char path[1024];
+		snprintf(path, sizeof(path), mPath.c_str(), frame.Index);
+		std::ofstream file(path, std::ios::binary);
+		file << "P6\n" << mWidth << " " << mHeight << "\n255\n";
+		file.write(reinterpret_cast<const char*>(rgb), pixelCount * 3);
+		return file.good();
+	}
+
+	//bt.601 studio range, full resolution chroma.
+	unsigned char* y = mPlanes.data();
+	unsigned char* u = y + pixelCount;
+	unsigned char* v = u + pixelCount;
+	for (int i = 0; i < pixelCount; i++)
+	{
+		int r = rgb[i * 3 + 0];
+		int g = rgb[i * 3 + 1];
+		int b = rgb[i * 3 + 2];
+		y[i] = static_cast<unsigned char>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+		u[i] = static_cast<unsigned char>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+		v[i] = static_cast<unsigned char>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+	}
+
+	mStream << "FRAME\n";
+	mStream.write(reinterpret_cast<const char*>(mPlanes.data()), pixelCount * 3);
+	return mStream.good();
+}
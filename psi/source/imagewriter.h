@@ -0,0 +1,60 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <condition_variable>
+#include <irenderer.h>
+
+//encodes and writes frames on its own thread, in the order they are pushed.
+//images are top-down rgb rows without padding, the layout Present writes.
+class ImageWriter
+{
+public:
+	ImageWriter() = default;
+
+	~ImageWriter();
+
+	ImageWriter(const ImageWriter&) = delete;
+	ImageWriter& operator = (const ImageWriter&) = delete;
+
+	//at most maxQueued frames wait for the writer, Push blocks beyond that.
+	bool Open(ImageFormat format, const char* path, int width, int height, int frameRate, int maxQueued);
+
+	//an image of the right size, recycled from written frames when possible.
+	std::vector<unsigned char> Acquire();
+
+	void Push(int frame, std::vector<unsigned char>&& image);
+
+	//waits for the queue to drain, false when any frame failed to write.
+	bool Close();
+
+private:
+	struct Frame
+	{
+		int Index;
+		std::vector<unsigned char> Image;
+	};
+
+	void WriterLoop();
+	bool WriteFrame(const Frame& frame);
+
+	ImageFormat mFormat = ImageFormat::Ppm;
+	std::string mPath;
+	int mWidth = 0;
+	int mHeight = 0;
+	int mMaxQueued = 1;
+
+	std::ofstream mStream;	//y4m only
+	std::vector<unsigned char> mPlanes;
+
+	std::thread mThread;
+	std::mutex mMutex;
+	std::condition_variable mChanged;
+	std::deque<Frame> mQueue;
+	std::vector<std::vector<unsigned char>> mFree;
+	bool mClosing = false;
+	bool mFailed = false;
+};
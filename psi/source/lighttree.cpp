@@ -0,0 +1,130 @@
+#include "pch.h"
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include "lighttree.h"
+
+void LightTree::Build(const Light* lights, int count)
+{
+	mLights = lights;
+	mNodes.clear();
+	mOrder.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		mOrder[i] = i;
+	}
+
+	if (count > 0)
+	{
+		mNodes.reserve(count * 2);
+		Build(0, count);
+	}
+}
+
+int LightTree::Build(int start, int end)
+{
+	int index = static_cast<int>(mNodes.size());
+	mNodes.resize(index + 1);
+
+	gml::aabb aabb;
+	float power = 0.0f;
+	float reach = 0.0f;
+	for (int i = start; i < end; i++)
+	{
+		const Light& light = mLights[mOrder[i]];
+		aabb.expand(light.Position);
+		power += light.Intensity * (light.Color.r + light.Color.g + light.Color.b) * (1.0f / 3.0f);
+
+		float range = light.Range > 0.0f ? light.Range : FLT_MAX;
+		if (range > reach)
+		{
+			reach = range;
+		}
+	}
+
+	Node& node = mNodes[index];
+	node.Center = aabb.center();
+	node.RadiusSquare = (aabb.max_bound() - node.Center).length_sqr();
+	node.Power = power;
+	node.Reach = reach;
+	node.Light = -1;
+	node.Right = 0;
+
+	if (end - start == 1)
+	{
+		node.Light = mOrder[start];
+		return index;
+	}
+
+	gml::vec3 size = aabb.max_bound() - aabb.min_bound();
+	int axis = (size.x > size.y) ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+	int middle = (start + end) / 2;
+	std::nth_element(mOrder.begin() + start, mOrder.begin() + middle, mOrder.begin() + end,
+		[this, axis](int a, int b)
+		{
+			gml::vec3 pa = mLights[a].Position;
+			gml::vec3 pb = mLights[b].Position;
+			return pa[axis] < pb[axis];
+		});
+
+	Build(start, middle);
+	int right = Build(middle, end);
+	mNodes[index].Right = right;
+	return index;
+}
+
+float LightTree::Importance(const Node& node, const gml::vec3& position) const
+{
+	//power over squared distance, clamped inside the cluster bounds.
+	float distance2 = (position - node.Center).length_sqr();
+	if (node.Reach < FLT_MAX)
+	{
+		float reach = node.Reach + sqrt(node.RadiusSquare);
+		if (distance2 > reach * reach)
+		{
+			return 0.0f;
+		}
+	}
+
+	return node.Power / (distance2 > node.RadiusSquare ? distance2 : node.RadiusSquare + 1e-4f);
+}
+
+int LightTree::Sample(const gml::vec3& position, float u, float& pdf) const
+{
+	pdf = 1.0f;
+	if (mNodes.empty())
+	{
+		return -1;
+	}
+
+	int index = 0;
+	while (mNodes[index].Light < 0)
+	{
+		int left = index + 1;
+		int right = mNodes[index].Right;
+		float importanceLeft = Importance(mNodes[left], position);
+		float importanceRight = Importance(mNodes[right], position);
+		float total = importanceLeft + importanceRight;
+		if (total <= 0.0f)
+		{
+			return -1;
+		}
+
+		//reuse u for the next level after choosing a side.
+		float probabilityLeft = importanceLeft / total;
+		if (u < probabilityLeft)
+		{
+			u /= probabilityLeft;
+			pdf *= probabilityLeft;
+			index = left;
+		}
+		else
+		{
+			u = (u - probabilityLeft) / (1.0f - probabilityLeft);
+			pdf *= 1.0f - probabilityLeft;
+			index = right;
+		}
+	}
+
+	return mNodes[index].Light;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include <material.h>
+#include <gmlaabb.h>
+
+//binary hierarchy over point lights, used to pick one light per
+//shadow ray with probability proportional to its estimated contribution.
+class LightTree
+{
+public:
+	void Build(const Light* lights, int count);
+
+	int Sample(const gml::vec3& position, float u, float& pdf) const;
+
+private:
+	struct Node
+	{
+		gml::vec3 Center;
+		float RadiusSquare;
+		float Power;
+		float Reach;	//largest light range, FLT_MAX when any light is unbounded
+		int Light;		//light index for leaf, -1 for inner node
+		int Right;		//right child, left child follows the node
+	};
+
+	int Build(int start, int end);
+	float Importance(const Node& node, const gml::vec3& position) const;
+
+	const Light* mLights = nullptr;
+	std::vector<int> mOrder;
+	std::vector<Node> mNodes;
+};
@@ -0,0 +1,71 @@
+#include "pch.h"
+#include <gmlray.h>
+#include "mesh.h"
+#include "geometry.h"
+
+namespace
+{
+	const int MAX_LEAF_TRIANGLES = 4;
+}
+
+Mesh::Mesh(const float* verts, int vertCount, const int* indices, int indexCount)
+{
+	mVerts.resize(vertCount);
+	for (int i = 0; i < vertCount; i++)
+	{
+		mVerts[i].set(verts[i * 3], verts[i * 3 + 1], verts[i * 3 + 2]);
+		mAABB.expand(mVerts[i]);
+	}
+
+	mIndices.assign(indices, indices + indexCount);
+
+	int triangleCount = GetTriangleCount();
+	std::vector<gml::aabb> bounds(triangleCount);
+	for (int i = 0; i < triangleCount; i++)
+	{
+		for (int v = 0; v < 3; v++)
+		{
+			bounds[i].expand(mVerts[mIndices[i * 3 + v]]);
+		}
+	}
+	mBvh.Build(bounds, MAX_LEAF_TRIANGLES);
+}
+
+bool Mesh::IntersectTriangle(const gml::ray& ray, int triangle, float mint, HitInfo& info) const
+{
+	float t, u, v;
+	if (IntersectTriangleWithRay(ray,
+		mVerts[mIndices[triangle * 3]],
+		mVerts[mIndices[triangle * 3 + 1]],
+		mVerts[mIndices[triangle * 3 + 2]],
+		t, u, v) && t < mint)
+	{
+		info.t = t;
+		info.primitive = triangle;
+		info.u = u;
+		info.v = v;
+		return true;
+	}
+	return false;
+}
+
+gml::vec3 Mesh::GetNormal(int triangle) const
+{
+	return GetTriangleNormal(
+		mVerts[mIndices[triangle * 3]],
+		mVerts[mIndices[triangle * 3 + 1]],
+		mVerts[mIndices[triangle * 3 + 2]]);
+}
+
+bool Mesh::IntersectWithRay(const gml::ray& ray, float mint, HitInfo& info) const
+{
+	return mBvh.Traverse(ray, mint, [this, &ray, &info](int triangle, float& maxt)
+	{
+		if (IntersectTriangle(ray, triangle, maxt, info))
+		{
+			maxt = info.t;
+			return true;
+		}
+		return false;
+	});
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <vector>
+#include <isceneobject.h>
+#include "bvh4.h"
+
+//triangle geometry shared by every instance referring to it,
+//together with its bottom-level bvh. lives in object space.
+class Mesh
+{
+public:
+	Mesh(const float* verts, int vertCount, const int* indices, int indexCount);
+
+	Mesh(const Mesh&) = delete;
+	Mesh& operator = (const Mesh&) = delete;
+
+	bool IntersectWithRay(const gml::ray& ray, float mint, HitInfo& info) const;
+
+	gml::vec3 GetNormal(int triangle) const;
+
+	inline const gml::aabb& GetAABB() const { return mAABB; }
+
+	inline int GetTriangleCount() const { return static_cast<int>(mIndices.size()) / 3; }
+
+private:
+	bool IntersectTriangle(const gml::ray& ray, int triangle, float mint, HitInfo& info) const;
+
+	gml::aabb mAABB;
+	std::vector<gml::vec3> mVerts;
+	std::vector<int> mIndices;
+	Bvh4 mBvh;
+};
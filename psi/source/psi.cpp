@@ -44,7 +44,7 @@ void RenderScene()
 }
 
 
-bool Initialize(HWND hWnd)
+bool Initialize(HWND hWnd, const char* scenePath)
 {
 	srand(static_cast<unsigned>(time(0)));
 	CenterWindow(hWnd);
@@ -65,7 +65,11 @@ bool Initialize(HWND hWnd)
 	colorBuffer = new unsigned char[SCREEN_WIDTH * SCREEN_HEIGHT * 3];
 
 	renderer = IRenderer::Create();
-	scene = IScene::Create();
+	scene = (scenePath != nullptr) ? IScene::Create(scenePath) : IScene::Create();
+	if (scene == nullptr)
+	{
+		return false;
+	}
 
 	needRenderScene = true;
 	renderThread = std::thread(RenderScene);
@@ -1,7 +1,10 @@
 #include "pch.h"
-#include <thread>
+#include <float.h>
+#include <algorithm>
 #include <iscene.h>
 #include "renderer.h"
+#include "threadpool.h"
+#include "imagewriter.h"
 #include <gmlutility.h>
 #include <gmlray.h>
 #include <gmlcolor.h>
@@ -22,10 +25,9 @@ void IRenderer::Release()
 	delete this;
 }
 
+//one tile of the frame, the unit of work handed to the thread pool.
 struct PresentStuff
 {
-	std::thread thread;
-
 	int xStart;
 	int xEnd;
 	int yStart;
@@ -36,61 +38,435 @@ struct PresentStuff
 	int height;
 
 	unsigned char* canvas;
+	const Camera* camera;
+	unsigned int frameIndex;
+};
 
-	void Join()
-	{
-		thread.join();
-	}
+//a view of a batch, with the scene and camera it is rendered from.
+struct BatchView
+{
+	const IScene* scene;
+	const Camera* camera;
+	const RenderView* target;
+	unsigned int frameIndex;
+};
+
+//objects a tile can see, an empty culled list still means nothing to hit.
+struct CandidateList
+{
+	std::vector<ISceneObject*> objects;
+	bool culled = false;
+};
+
+//per thread scratch for the tile being rendered, primary hits are kept
+//so the shadow volumes can be bounded before shading.
+struct TileCulling
+{
+	CandidateList primary;
+	std::vector<CandidateList> shadows;	//per light, none when lights are sampled
+	int shadowCount = 0;
+
+	std::vector<gml::ray> rays;
+	std::vector<HitInfo> hits;
+	std::vector<const ISceneObject*> hitObjects;
 };
 
 namespace
 {
 	const int RECCURSIVE_DEPTH = 4;
+	const float BIAS = 1e-3f;
+
+	//past this many candidates a list is slower than the accelerator.
+	const int MAX_TILE_CANDIDATES = 32;
+	const int MAX_SHADOW_LIGHTS = 8;
+
+	//tile size must be power of two, so the curves cover the whole tile.
+	const int TILE_SHIFT = 4;
+	const int TILE_SIZE = 1 << TILE_SHIFT;
+
+	thread_local TileCulling TileScratch;
+
+	//pixel rectangle of a view, in the bottom-up rows rays are generated in.
+	void GetViewBounds(const RenderView& view, int b[4])
+	{
+		b[0] = 0;
+		b[1] = 0;
+		b[2] = view.Width;
+		b[3] = view.Height;
+		if (view.RegionWidth > 0 && view.RegionHeight > 0)
+		{
+			int x0 = view.RegionX;
+			int y0 = view.Height - view.RegionY - view.RegionHeight;
+			int x1 = view.RegionX + view.RegionWidth;
+			int y1 = view.Height - view.RegionY;
+			b[0] = x0 > 0 ? x0 : 0;
+			b[1] = y0 > 0 ? y0 : 0;
+			b[2] = x1 < view.Width ? x1 : view.Width;
+			b[3] = y1 < view.Height ? y1 : view.Height;
+		}
+	}
+
+	int CountTiles(const int b[4])
+	{
+		int tileCols = b[2] > b[0] ? (b[2] - b[0] + TILE_SIZE - 1) / TILE_SIZE : 0;
+		int tileRows = b[3] > b[1] ? (b[3] - b[1] + TILE_SIZE - 1) / TILE_SIZE : 0;
+		return tileCols * tileRows;
+	}
+
+	int PackTileOffset(int x, int y)
+	{
+		return x | (y << 16);
+	}
+
+	void MortonDecode(int d, int& x, int& y)
+	{
+		x = 0;
+		y = 0;
+		for (int i = 0; i < TILE_SHIFT; i++)
+		{
+			x |= ((d >> (2 * i)) & 1) << i;
+			y |= ((d >> (2 * i + 1)) & 1) << i;
+		}
+	}
+
+	void HilbertDecode(int d, int& x, int& y)
+	{
+		x = 0;
+		y = 0;
+		for (int s = 1; s < TILE_SIZE; s *= 2)
+		{
+			int rx = 1 & (d / 2);
+			int ry = 1 & (d ^ rx);
+			if (ry == 0)
+			{
+				if (rx == 1)
+				{
+					x = s - 1 - x;
+					y = s - 1 - y;
+				}
+				int t = x;
+				x = y;
+				y = t;
+			}
+			x += s * rx;
+			y += s * ry;
+			d /= 4;
+		}
+	}
+
+	//per pixel random sequence, reseeded before each primary ray.
+	thread_local unsigned int RandomState = 1;
+
+	void SeedRandom(int x, int y, unsigned int frame)
+	{
+		unsigned int h = static_cast<unsigned int>(x) * 73856093u ^ static_cast<unsigned int>(y) * 19349663u ^ frame * 83492791u;
+		RandomState = h != 0 ? h : 1;
+	}
+
+	float Random()
+	{
+		//xorshift32
+		RandomState ^= RandomState << 13;
+		RandomState ^= RandomState >> 17;
+		RandomState ^= RandomState << 5;
+		return (RandomState >> 8) * (1.0f / 16777216.0f);
+	}
+
+	ISceneObject* IntersectWithRay(const IScene* scene, const CandidateList* candidates, const gml::ray& ray, HitInfo& info)
+	{
+		if (candidates == nullptr || !candidates->culled)
+		{
+			return scene->IntersectWithRay(ray, info);
+		}
 
-	const int THREAD_ROW = 2;
-	const int THREAD_COL = 4;
-	const int THREAD_COUNT = THREAD_ROW * THREAD_COL;
+		info.t = FLT_MAX;
+		ISceneObject* hitObject = nullptr;
+		for (ISceneObject* object : candidates->objects)
+		{
+			if (object->IntersectWithRay(ray, info.t, info))
+			{
+				hitObject = object;
+			}
+		}
+		return hitObject;
+	}
+
+	//false when the box is entirely behind a plane through origin.
+	bool IsInFront(const gml::vec3& origin, const gml::vec3& normal, const gml::aabb& aabb)
+	{
+		const gml::vec3& minBound = aabb.min_bound();
+		const gml::vec3& maxBound = aabb.max_bound();
+		gml::vec3 farthest(
+			normal.x > 0 ? maxBound.x : minBound.x,
+			normal.y > 0 ? maxBound.y : minBound.y,
+			normal.z > 0 ? maxBound.z : minBound.z);
+		return dot(normal, farthest - origin) >= 0;
+	}
+
+	//side planes of a tile through the eye, plus one that drops boxes behind the eye.
+	class FrustumFilter : public IBoundsFilter
+	{
+	public:
+		virtual bool Overlaps(const gml::aabb& aabb) const
+		{
+			for (int p = 0; p < 5; p++)
+			{
+				if (!IsInFront(Eye, Planes[p], aabb))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		gml::vec3 Eye;
+		gml::vec3 Planes[5];
+	};
+
+	class BoxFilter : public IBoundsFilter
+	{
+	public:
+		virtual bool Overlaps(const gml::aabb& aabb) const
+		{
+			return IsOverlapped(aabb, Box);
+		}
+
+		gml::aabb Box;
+	};
+
+	void QueryCandidates(const IScene* scene, const IBoundsFilter& filter, CandidateList& candidates)
+	{
+		int count;
+		candidates.objects.resize(MAX_TILE_CANDIDATES);
+		candidates.culled = scene->QueryObjects(filter, candidates.objects.data(), MAX_TILE_CANDIDATES, count);
+		candidates.objects.resize(count);
+	}
+
+	gml::color3 ShadeLight(const IScene* scene, const CandidateList* occluders, gml::ray& shadowRay, const gml::vec3& position, const gml::vec3& normal, const Light& light)
+	{
+		gml::vec3 Point2Light = light.Position - position;
+		float distance2 = Point2Light.length_sqr();
+		float attenuation = 1.0f;
+		if (light.Range > 0.0f)
+		{
+			float falloff = 1.0f - distance2 / (light.Range * light.Range);
+			if (falloff <= 0.0f)
+			{
+				return gml::color3::black();
+			}
+			attenuation = falloff * falloff;
+		}
+
+		shadowRay.set_dir(Point2Light);
+
+		HitInfo st;
+		ISceneObject* shadowHitObject = IntersectWithRay(scene, occluders, shadowRay, st);
+		if (shadowHitObject != nullptr && (st.t * st.t) < distance2)
+		{
+			return gml::color3::black();
+		}
+
+		float cosS = dot(normal, shadowRay.direction());
+		if (cosS < 0)
+			cosS = 0.0f;
+
+		return light.Color * (cosS * light.Intensity * attenuation);
+	}
+}
 
-	PresentStuff PresentThreads[THREAD_COUNT];
+Renderer::Renderer()
+{
+	SetPixelOrder(PixelOrder::Morton);
+}
+
+void Renderer::SetPixelOrder(PixelOrder order)
+{
+	mTileOrder.resize(TILE_SIZE * TILE_SIZE);
+
+	int x, y;
+	for (int d = 0; d < TILE_SIZE * TILE_SIZE; d++)
+	{
+		switch (order)
+		{
+		case PixelOrder::Morton:	MortonDecode(d, x, y); break;
+		case PixelOrder::Hilbert:	HilbertDecode(d, x, y); break;
+		default:					x = d % TILE_SIZE; y = d / TILE_SIZE; break;
+		}
+		mTileOrder[d] = PackTileOffset(x, y);
+	}
+}
+
+void Renderer::SetLightSampleCount(int count)
+{
+	mLightSampleCount = count;
 }
 
 void Renderer::Present(const IScene* scene, unsigned char* canvas, int width, int height, int pitch)
 {
-	int xSeg = width / THREAD_COL;
-	int ySeg = height / THREAD_ROW;
+	RenderView view;
+	view.Buffer = canvas;
+	view.Width = width;
+	view.Height = height;
+	view.Pitch = pitch;
+
+	BatchView batch = { scene, &mCamera, &view, ++mFrameIndex };
+	PresentBatch(&batch, 1);
+}
+
+void Renderer::PresentViews(const IScene* scene, const RenderView* views, int count)
+{
+	std::vector<Camera> cameras(count);
+	std::vector<BatchView> batch(count);
+	mFrameIndex++;
+	for (int i = 0; i < count; i++)
+	{
+		SetupCamera(cameras[i], views[i]);
+		batch[i] = { scene, &cameras[i], &views[i], mFrameIndex };
+	}
+	PresentBatch(batch.data(), count);
+}
 
-	for (int i = 0; i < THREAD_ROW; i++)
+bool Renderer::RenderAnimation(IScene* const* scenes, int sceneCount, const AnimationDesc& desc)
+{
+	if (sceneCount <= 0 || desc.FrameCount <= 0)
 	{
-		for (int j = 0; j < THREAD_COL; j++)
+		return false;
+	}
+
+	//two images per scene, one rendering while the other waits for the writer.
+	ImageWriter writer;
+	if (!writer.Open(desc.Format, desc.Path, desc.Width, desc.Height, desc.FrameRate, sceneCount * 2))
+	{
+		return false;
+	}
+
+	std::vector<RenderView> targets(sceneCount);
+	std::vector<BatchView> batch(sceneCount);
+	std::vector<std::vector<unsigned char>> images(sceneCount);
+	for (int first = 0; first < desc.FrameCount; first += sceneCount)
+	{
+		int count = desc.FrameCount - first < sceneCount ? desc.FrameCount - first : sceneCount;
+		for (int i = 0; i < count; i++)
+		{
+			//each frame has a scene of its own, noise depends on the frame number only.
+			int frame = desc.FirstFrame + first + i;
+			scenes[i]->SetFrame(frame);
+
+			images[i] = writer.Acquire();
+			targets[i].Buffer = images[i].data();
+			targets[i].Width = desc.Width;
+			targets[i].Height = desc.Height;
+			targets[i].Pitch = desc.Width * 3;
+			batch[i] = { scenes[i], &mCamera, &targets[i], static_cast<unsigned int>(frame) };
+		}
+
+		PresentBatch(batch.data(), count);
+
+		for (int i = 0; i < count; i++)
 		{
-			int index = j + i * THREAD_COL;
-			PresentThreads[index].xStart = j * xSeg;
-			PresentThreads[index].yStart = i * ySeg;
-			PresentThreads[index].xEnd = (j + 1) * xSeg;
-			PresentThreads[index].yEnd = (i + 1) * ySeg;
+			writer.Push(desc.FirstFrame + first + i, std::move(images[i]));
+		}
+	}
+	return writer.Close();
+}
+
+void Renderer::SetupCamera(Camera& camera, const RenderView& view)
+{
+	camera.SetPosition(view.Eye[0], view.Eye[1], view.Eye[2]);
+	camera.SetFOV(view.FOV);
+	camera.LookAt(gml::vec3(view.Target[0], view.Target[1], view.Target[2]), gml::vec3(view.Up[0], view.Up[1], view.Up[2]));
+}
+
+int Renderer::GetTileCount(const RenderView& view)
+{
+	int b[4];
+	GetViewBounds(view, b);
+	return CountTiles(b);
+}
+
+void Renderer::RenderTile(const IScene* scene, const Camera& camera, const RenderView& view, int tile, unsigned int frameIndex)
+{
+	int b[4];
+	GetViewBounds(view, b);
+	BatchView batch = { scene, &camera, &view, frameIndex };
+	RenderTile(batch, b, tile);
+}
 
-			PresentThreads[index].pitch = pitch;
-			PresentThreads[index].width = width;
-			PresentThreads[index].height = height;
-			PresentThreads[index].canvas = canvas;
+void Renderer::RenderTile(const BatchView& batch, const int bounds[4], int tile)
+{
+	const RenderView& view = *(batch.target);
+	int tileCols = (bounds[2] - bounds[0] + TILE_SIZE - 1) / TILE_SIZE;
+
+	PresentStuff seg;
+	seg.xStart = bounds[0] + (tile % tileCols) * TILE_SIZE;
+	seg.yStart = bounds[1] + (tile / tileCols) * TILE_SIZE;
+	seg.xEnd = seg.xStart + TILE_SIZE < bounds[2] ? seg.xStart + TILE_SIZE : bounds[2];
+	seg.yEnd = seg.yStart + TILE_SIZE < bounds[3] ? seg.yStart + TILE_SIZE : bounds[3];
+
+	seg.pitch = view.Pitch;
+	seg.width = view.Width;
+	seg.height = view.Height;
+	seg.canvas = view.Buffer;
+	seg.camera = batch.camera;
+	seg.frameIndex = batch.frameIndex;
+
+	InternalPresent(&seg, batch.scene);
+}
 
-			if (PresentThreads[index].xEnd > width)
-				PresentThreads[index].xEnd = width;
-			if (PresentThreads[index].yEnd > height)
-				PresentThreads[index].yEnd = height;
+void Renderer::PresentBatch(const BatchView* views, int count)
+{
+	//tiles of all views are numbered one after another, so small views
+	//do not leave workers idle while the batch is still running.
+	std::vector<int> bounds(count * 4);
+	std::vector<int> firstTile(count + 1, 0);
+	for (int i = 0; i < count; i++)
+	{
+		GetViewBounds(*(views[i].target), &(bounds[i * 4]));
+		firstTile[i + 1] = firstTile[i] + CountTiles(&(bounds[i * 4]));
+	}
 
-			PresentThreads[index].thread = std::thread(&Renderer::InternalPresent, this, &(PresentThreads[index]), scene);
+	ThreadPool::Get().ParallelFor(firstTile[count], [&](int index)
+	{
+		int v = static_cast<int>(std::upper_bound(firstTile.begin(), firstTile.end(), index) - firstTile.begin()) - 1;
+		RenderTile(views[v], &(bounds[v * 4]), index - firstTile[v]);
+	});
+}
+
+gml::color3 Renderer::DirectLighting(const IScene* scene, const gml::vec3& position, const gml::vec3& normal, const TileCulling* tile)
+{
+	gml::color3 color = scene->GetAmbientColor();
+	gml::ray shadowRay;
+	shadowRay.set_origin(position + normal * BIAS);
+
+	int lightCount = scene->GetLightCount();
+	int culledCount = tile != nullptr ? tile->shadowCount : 0;
+	if (mLightSampleCount <= 0 || mLightSampleCount >= lightCount)
+	{
+		for (int l = 0; l < lightCount; ++l)
+		{
+			const CandidateList* occluders = l < culledCount ? &(tile->shadows[l]) : nullptr;
+			color += ShadeLight(scene, occluders, shadowRay, position, normal, scene->GetLightList()[l]);
 		}
 	}
-	for (auto& t : PresentThreads)
+	else
 	{
-		t.Join();
+		//few lights picked by the scene light tree, weighted by 1 / (count * pdf).
+		float weight = 1.0f / mLightSampleCount;
+		for (int s = 0; s < mLightSampleCount; ++s)
+		{
+			float pdf;
+			int l = scene->SampleLight(position, Random(), pdf);
+			if (l >= 0 && pdf > 0.0f)
+			{
+				color += ShadeLight(scene, nullptr, shadowRay, position, normal, scene->GetLightList()[l]) * (weight / pdf);
+			}
+		}
 	}
+	return color;
 }
 
 gml::color3 Renderer::Trace(const IScene* scene, const gml::ray& ray, int reccursiveDepth)
 {
-	const float BIAS = 1e-3f;
 	if (reccursiveDepth > RECCURSIVE_DEPTH)
 	{
 		return mClearColor;
@@ -98,134 +474,200 @@ gml::color3 Renderer::Trace(const IScene* scene, const gml::ray& ray, int reccur
 
 	HitInfo t;
 	ISceneObject* hitObject = scene->IntersectWithRay(ray, t);
+	return Shade(scene, ray, hitObject, t, reccursiveDepth, nullptr);
+}
+
+gml::color3 Renderer::Shade(const IScene* scene, const gml::ray& ray, const ISceneObject* hitObject, const HitInfo& t, int reccursiveDepth, const TileCulling* tile)
+{
 	if (hitObject == nullptr)
 	{
 		return mClearColor;
 	}
 
-	gml::vec3 intersectPosition = ray.get_offset(t.t);
+	//attributes only for the closest hit, traversal records t and barycentrics.
+	SurfaceInfo surface;
+	hitObject->ComputeSurface(ray, t, surface);
+	const gml::vec3& intersectPosition = surface.position;
+	gml::vec3& normal = surface.normal;
+
 	gml::color3 color;
-	const Material* material = hitObject->GetMaterial();
+	const Material* material = surface.material;
 	if (material->IsReflective && reccursiveDepth < RECCURSIVE_DEPTH)	//
 	{
 		bool isInside = false;
-		if (dot(t.normal, ray.direction()) > 0)
+		if (dot(normal, ray.direction()) > 0)
 		{
 			isInside = true;
-			t.normal = -t.normal;
+			normal = -normal;
 		}
 
-		float facingRatio = dot(t.normal, -ray.direction());
+		float facingRatio = dot(normal, -ray.direction());
 		float fresnel = gml::lerp(pow(1.0f - facingRatio, 2.5f), 1.0f, 0.05f);
 
 		float ior = 1.1f;
 		float eta = isInside ? ior : 1.0f / ior;
-		float cosi = dot(-t.normal, ray.direction());
+		float cosi = dot(-normal, ray.direction());
 		float cosr = 1.0f - eta * eta * (1.0f - cosi * cosi);
 
-		gml::vec3 biasNormal = t.normal * BIAS;
+		gml::vec3 biasNormal = normal * BIAS;
 		gml::ray reflectRay;
 		reflectRay.set_origin(intersectPosition + biasNormal);
-		reflectRay.set_dir(ray.direction() - 2 * t.normal * dot(t.normal, ray.direction()));
+		reflectRay.set_dir(ray.direction() - 2 * normal * dot(normal, ray.direction()));
 		gml::color3 reflectColor = Trace(scene, reflectRay, reccursiveDepth + 1);
 
 		if (material->IsTransparent)
 		{
 			gml::ray refractRay;
 			refractRay.set_origin(intersectPosition - biasNormal);
-			refractRay.set_dir(ray.direction() * eta + t.normal * (eta * cosi - sqrt(cosr)));
+			refractRay.set_dir(ray.direction() * eta + normal * (eta * cosi - sqrt(cosr)));
 			gml::color3 refractColor = Trace(scene, refractRay, reccursiveDepth + 1);
 
 			color = lerp(refractColor, reflectColor, fresnel);
 		}
 		else
 		{
-			gml::color3 surfaceColor = scene->GetAmbientColor();
-
-			gml::ray shadowRay;
-			shadowRay.set_origin(intersectPosition + t.normal * BIAS);
-
-			for (int l = 0, lightCount = scene->GetLightCount(); l < lightCount; ++l)
-			{
-				const Light& light = scene->GetLightList()[l];
-				gml::vec3 Point2Light = light.Position - intersectPosition;
-				float distance2 = Point2Light.length_sqr();
-				shadowRay.set_dir(Point2Light);
-
-				HitInfo st;
-				bool shadow = false;
-				ISceneObject* shadowHitObject = scene->IntersectWithRay(shadowRay, st);
-				if (shadowHitObject != nullptr && (st.t * st.t) < distance2)
-				{
-					shadow = true;
-				}
-				if (!shadow)
-				{
-					float cosS = dot(t.normal, shadowRay.direction());
-					if (cosS < 0)
-						cosS = 0.0f;
-
-					surfaceColor += light.Color * cosS * light.Intensity;
-				}
-			}
+			gml::color3 surfaceColor = DirectLighting(scene, intersectPosition, normal, tile);
 			color = lerp(surfaceColor, reflectColor, 0.02f);
 		}
 
 	}
 	else
 	{
-		color = scene->GetAmbientColor();
-		gml::ray shadowRay;
-		shadowRay.set_origin(intersectPosition + t.normal * BIAS);
+		color = DirectLighting(scene, intersectPosition, normal, tile);
+	}
 
-		for (int l = 0, lightCount = scene->GetLightCount(); l < lightCount; ++l)
-		{
-			const Light& light = scene->GetLightList()[l];
-			gml::vec3 Point2Light = light.Position - intersectPosition;
-			float distance2 = Point2Light.length_sqr();
-			shadowRay.set_dir(Point2Light);
+	color.clamp();
+	return color;
+}
 
-			HitInfo st;
-			bool shadow = false;
-			ISceneObject* shadowHitObject = scene->IntersectWithRay(shadowRay, st);
-			if (shadowHitObject != nullptr && (st.t * st.t) < distance2)
-			{
-				shadow = true;
-			}
-			if (!shadow)
-			{
-				float cosS = dot(t.normal, shadowRay.direction());
-				if (cosS < 0)
-					cosS = 0.0f;
 
-				color += light.Color * cosS * light.Intensity;
-			}
+void Renderer::CullTile(const IScene* scene, const Camera& camera, TileCulling& tile, int width, int height, int x0, int y0, int x1, int y1)
+{
+	//side planes through the eye and the tile corners, the last one drops objects behind the eye.
+	FrustumFilter frustum;
+	frustum.Eye = camera.GetPosition();
+	gml::vec3 corners[4] = {
+		camera.GetDirection(width, height, static_cast<float>(x0), static_cast<float>(y0)),
+		camera.GetDirection(width, height, static_cast<float>(x1), static_cast<float>(y0)),
+		camera.GetDirection(width, height, static_cast<float>(x1), static_cast<float>(y1)),
+		camera.GetDirection(width, height, static_cast<float>(x0), static_cast<float>(y1)),
+	};
+	gml::vec3 center = camera.GetDirection(width, height, (x0 + x1) * 0.5f, (y0 + y1) * 0.5f);
+
+	gml::vec3* planes = frustum.Planes;
+	for (int i = 0; i < 4; i++)
+	{
+		planes[i] = cross(corners[i], corners[(i + 1) % 4]);
+		if (dot(planes[i], center) < 0)
+		{
+			planes[i] = -planes[i];
 		}
 	}
+	planes[4] = center;
 
-	color.clamp();
-	return color;
+	QueryCandidates(scene, frustum, tile.primary);
 }
 
+void Renderer::CullShadows(const IScene* scene, TileCulling& tile)
+{
+	tile.shadowCount = 0;
+
+	int lightCount = scene->GetLightCount();
+	bool sampled = mLightSampleCount > 0 && mLightSampleCount < lightCount;
+	if (sampled || lightCount > MAX_SHADOW_LIGHTS)
+	{
+		return;
+	}
+
+	gml::aabb hitBounds;
+	bool hasHits = false;
+	for (int i = 0; i < TILE_SIZE * TILE_SIZE; i++)
+	{
+		if (tile.hitObjects[i] != nullptr)
+		{
+			hitBounds.expand(tile.rays[i].get_offset(tile.hits[i].t));
+			hasHits = true;
+		}
+	}
+	if (!hasHits)
+	{
+		return;
+	}
+
+	if (tile.shadows.size() < static_cast<size_t>(lightCount))
+	{
+		tile.shadows.resize(lightCount);
+	}
+	tile.shadowCount = lightCount;
+
+	gml::vec3 bias(BIAS, BIAS, BIAS);
+	for (int l = 0; l < lightCount; ++l)
+	{
+		//every shadow segment of the tile lies in the box of its hit points and the light.
+		BoxFilter volume;
+		volume.Box = hitBounds;
+		volume.Box.expand(scene->GetLightList()[l].Position);
+		gml::vec3 minBound = volume.Box.min_bound() - bias;
+		gml::vec3 maxBound = volume.Box.max_bound() + bias;
+		volume.Box.expand(minBound);
+		volume.Box.expand(maxBound);
+
+		QueryCandidates(scene, volume, tile.shadows[l]);
+	}
+}
 
 void Renderer::InternalPresent(PresentStuff* seg, const IScene* scene)
 {
 	int index;
 	gml::color3 color;
 
+	TileCulling& tile = TileScratch;
+	if (tile.rays.empty())
+	{
+		tile.rays.resize(TILE_SIZE * TILE_SIZE);
+		tile.hits.resize(TILE_SIZE * TILE_SIZE);
+		tile.hitObjects.resize(TILE_SIZE * TILE_SIZE);
+	}
+
 	int indexOffset = seg->height - 1;
-	for (int y = seg->yStart; y < seg->yEnd; y++)
+	int tileX = seg->xStart;
+	int tileY = seg->yStart;
+	CullTile(scene, *(seg->camera), tile, seg->width, seg->height, seg->xStart, seg->yStart, seg->xEnd, seg->yEnd);
+
+	//primary hits first, their bounds limit the shadow candidates.
+	//walk the tile along the curve, neighbouring rays share scene nodes in cache.
+	for (int i = 0; i < TILE_SIZE * TILE_SIZE; i++)
 	{
-		for (int x = seg->xStart; x < seg->xEnd; x++)
+		int x = tileX + (mTileOrder[i] & 0xFFFF);
+		int y = tileY + (mTileOrder[i] >> 16);
+		tile.hitObjects[i] = nullptr;
+		if (x >= seg->xEnd || y >= seg->yEnd)
 		{
-			gml::ray ray = mCamera.GenerateRay(seg->width, seg->height, x, y);
-			color = Trace(scene, ray, 0);
+			continue;
+		}
 
-			index = x * 3 + (indexOffset - y) * seg->pitch;
-			unsigned int color_rgb = color.rgba();
-			seg->canvas[index + 0] = color_rgb & 0xFF;  //r
-			seg->canvas[index + 1] = (color_rgb >> 8) & 0xFF; //g
-			seg->canvas[index + 2] = (color_rgb >> 16) & 0xFF; //b
+		tile.rays[i] = seg->camera->GenerateRay(seg->width, seg->height, x, y);
+		tile.hitObjects[i] = IntersectWithRay(scene, &(tile.primary), tile.rays[i], tile.hits[i]);
+	}
+
+	CullShadows(scene, tile);
+
+	for (int i = 0; i < TILE_SIZE * TILE_SIZE; i++)
+	{
+		int x = tileX + (mTileOrder[i] & 0xFFFF);
+		int y = tileY + (mTileOrder[i] >> 16);
+		if (x >= seg->xEnd || y >= seg->yEnd)
+		{
+			continue;
 		}
+
+		SeedRandom(x, y, seg->frameIndex);
+		color = Shade(scene, tile.rays[i], tile.hitObjects[i], tile.hits[i], 0, &tile);
+
+		index = x * 3 + (indexOffset - y) * seg->pitch;
+		unsigned int color_rgb = color.rgba();
+		seg->canvas[index + 0] = color_rgb & 0xFF;  //r
+		seg->canvas[index + 1] = (color_rgb >> 8) & 0xFF; //g
+		seg->canvas[index + 2] = (color_rgb >> 16) & 0xFF; //b
 	}
 }
\ No newline at end of file
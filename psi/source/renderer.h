@@ -6,17 +6,45 @@
 #include <gmlcolor.h>
 
 struct PresentStuff;
+struct TileCulling;
+struct BatchView;
 
 class Renderer : public IRenderer
 {
 public:
+	Renderer();
+
+	virtual void SetPixelOrder(PixelOrder order);
+
+	virtual void SetLightSampleCount(int count);
+
 	virtual void Present(const IScene* scene, unsigned char* buffer, int width, int height, int pitch);
 
+	virtual void PresentViews(const IScene* scene, const RenderView* views, int count);
+
+	virtual bool RenderAnimation(IScene* const* scenes, int sceneCount, const AnimationDesc& desc);
+
+	//single tiles, for callers that schedule the work themselves like RenderService.
+	static void SetupCamera(Camera& camera, const RenderView& view);
+	static int GetTileCount(const RenderView& view);
+	void RenderTile(const IScene* scene, const Camera& camera, const RenderView& view, int tile, unsigned int frameIndex);
+
 private:
+	void PresentBatch(const BatchView* views, int count);
+	void RenderTile(const BatchView& batch, const int bounds[4], int tile);
 	void InternalPresent(PresentStuff* seg, const IScene* scene);
+	void CullTile(const IScene* scene, const Camera& camera, TileCulling& tile, int width, int height, int x0, int y0, int x1, int y1);
+	void CullShadows(const IScene* scene, TileCulling& tile);
 	gml::color3 Trace(const IScene* scene, const gml::ray& ray, int reccursiveDepth);
+	gml::color3 Shade(const IScene* scene, const gml::ray& ray, const ISceneObject* hitObject, const HitInfo& t, int reccursiveDepth, const TileCulling* tile);
+	gml::color3 DirectLighting(const IScene* scene, const gml::vec3& position, const gml::vec3& normal, const TileCulling* tile);
 	
 	Camera  mCamera;
 
+	std::vector<int> mTileOrder;	//packed (x, y) offsets inside a tile, in visiting order
+
+	int mLightSampleCount = 0;
+	unsigned int mFrameIndex = 0;
+
 	gml::color3 mClearColor = gml::color3::black();
 };
\ No newline at end of file
@@ -0,0 +1,739 @@
+#include "pch.h"
+#include <string.h>
+#include <stdio.h>
+#include <fstream>
+#include <algorithm>
+#include <ws2tcpip.h>
+#include <iscene.h>
+#include "renderfarm.h"
+#include "renderer.h"
+#include "threadpool.h"
+#include "scenefile.h"
+
+#pragma comment(lib, "ws2_32.lib")
+
+namespace
+{
+	const int FARM_UNIT_SIZE = 64;
+	const size_t MAX_UNITS_IN_FLIGHT = 2;	//one rendering, one waiting, workers never idle on the network
+	const int MAX_ASSIGNMENTS = 2;			//a straggling unit gets one backup worker
+	const unsigned long long STRAGGLER_MIN_TIME = 500;
+	const unsigned long long STRAGGLER_FACTOR = 4;
+	const unsigned long long CONNECT_TIMEOUT = 20000;
+	const long POLL_TIME = 50;
+	const unsigned int MAX_PACKET_SIZE = 1u << 30;
+
+	//packets are a header and a plain struct, results and jobs carry raw bytes after it.
+	//both ends are expected to share byte order and struct layout.
+	enum PacketType
+	{
+		PACKET_JOB = 1,
+		PACKET_REGION,
+		PACKET_RESULT,
+		PACKET_DONE,
+	};
+
+	struct PacketHeader
+	{
+		unsigned int Type;
+		unsigned int Size;
+	};
+
+	struct JobPacket
+	{
+		int JobId;
+		int Frame;
+		int Width;
+		int Height;
+		float Eye[3];
+		float Target[3];
+		float Up[3];
+		float FOV;
+		unsigned int SnapshotSize;	//0 keeps the scene loaded before
+	};
+
+	struct RegionPacket
+	{
+		int JobId;
+		int Unit;
+		int X;
+		int Y;
+		int Width;
+		int Height;
+	};
+
+	bool SendAll(SOCKET s, const void* data, size_t size)
+	{
+		const char* p = static_cast<const char*>(data);
+		while (size > 0)
+		{
+			int sent = ::send(s, p, static_cast<int>(size < (1u << 20) ? size : (1u << 20)), 0);
+			if (sent <= 0)
+			{
+				return false;
+			}
+			p += sent;
+			size -= sent;
+		}
+		return true;
+	}
+
+	bool ReceiveAll(SOCKET s, void* data, size_t size)
+	{
+		char* p = static_cast<char*>(data);
+		while (size > 0)
+		{
+			int received = ::recv(s, p, static_cast<int>(size < (1u << 20) ? size : (1u << 20)), 0);
+			if (received <= 0)
+			{
+				return false;
+			}
+			p += received;
+			size -= received;
+		}
+		return true;
+	}
+
+	bool SendPacket(SOCKET s, unsigned int type, const void* head, size_t headSize, const void* body = nullptr, size_t bodySize = 0)
+	{
+		PacketHeader header = { type, static_cast<unsigned int>(headSize + bodySize) };
+		return SendAll(s, &header, sizeof(header)) &&
+			SendAll(s, head, headSize) &&
+			SendAll(s, body, bodySize);
+	}
+
+	bool ReceivePacket(SOCKET s, unsigned int& type, std::vector<unsigned char>& payload)
+	{
+		PacketHeader header;
+		if (!ReceiveAll(s, &header, sizeof(header)) || header.Size > MAX_PACKET_SIZE)
+		{
+			return false;
+		}
+
+		type = header.Type;
+		payload.resize(header.Size);
+		return header.Size == 0 || ReceiveAll(s, payload.data(), header.Size);
+	}
+
+	bool ReadWholeFile(const char* path, std::vector<unsigned char>& data)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+		{
+			return false;
+		}
+
+		std::streamoff size = file.tellg();
+		data.resize(static_cast<size_t>(size));
+		file.seekg(0);
+		return size > 0 && file.read(reinterpret_cast<char*>(data.data()), size).good();
+	}
+
+	std::string GetTempFile()
+	{
+		char directory[MAX_PATH];
+		char path[MAX_PATH];
+		if (::GetTempPathA(MAX_PATH, directory) == 0 ||
+			::GetTempFileNameA(directory, "psi", 0, path) == 0)
+		{
+			return std::string();
+		}
+		return path;
+	}
+
+	void SetNoDelay(SOCKET s)
+	{
+		BOOL noDelay = TRUE;
+		::setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+	}
+}
+
+FarmCoordinator::~FarmCoordinator()
+{
+	for (Worker& worker : mWorkers)
+	{
+		SendPacket(worker.Socket, PACKET_DONE, nullptr, 0);
+		::closesocket(worker.Socket);
+	}
+
+	if (mListen != INVALID_SOCKET)
+	{
+		::closesocket(mListen);
+	}
+
+	for (HANDLE process : mProcesses)
+	{
+		if (::WaitForSingleObject(process, 5000) != WAIT_OBJECT_0)
+		{
+			::TerminateProcess(process, 1);
+		}
+		::CloseHandle(process);
+	}
+
+	if (mStarted)
+	{
+		::WSACleanup();
+	}
+}
+
+bool FarmCoordinator::Listen(unsigned short port)
+{
+	WSADATA data;
+	if (!mStarted)
+	{
+		if (::WSAStartup(MAKEWORD(2, 2), &data) != 0)
+		{
+			return false;
+		}
+		mStarted = true;
+	}
+
+	mListen = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (mListen == INVALID_SOCKET)
+	{
+		return false;
+	}
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	int length = sizeof(address);
+	if (::bind(mListen, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR ||
+		::listen(mListen, SOMAXCONN) == SOCKET_ERROR ||
+		::getsockname(mListen, reinterpret_cast<sockaddr*>(&address), &length) == SOCKET_ERROR)
+	{
+		::closesocket(mListen);
+		mListen = INVALID_SOCKET;
+		return false;
+	}
+
+	//port 0 picks a free one.
+	mPort = ntohs(address.sin_port);
+	return true;
+}
+
+bool FarmCoordinator::SpawnLocalWorkers(int count)
+{
+	wchar_t executable[MAX_PATH];
+	if (mListen == INVALID_SOCKET || ::GetModuleFileNameW(NULL, executable, MAX_PATH) == 0)
+	{
+		return false;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		wchar_t commandLine[MAX_PATH + 64];
+		swprintf(commandLine, MAX_PATH + 64, L"\"%ls\" -farm-worker 127.0.0.1 %u", executable, static_cast<unsigned int>(mPort));
+
+		STARTUPINFOW startup = {};
+		startup.cb = sizeof(startup);
+		PROCESS_INFORMATION process;
+		if (!::CreateProcessW(executable, commandLine, NULL, NULL, FALSE, 0, NULL, NULL, &startup, &process))
+		{
+			return false;
+		}
+		::CloseHandle(process.hThread);
+		mProcesses.push_back(process.hProcess);
+	}
+	return true;
+}
+
+bool FarmCoordinator::Render(const char* scenePath, int frame, const RenderView& view)
+{
+	if (mListen == INVALID_SOCKET || view.Buffer == nullptr || view.Width <= 0 || view.Height <= 0 ||
+		!LoadScene(scenePath))
+	{
+		return false;
+	}
+
+	//results still on their way from the last frame are told apart by the job id.
+	mJobId++;
+	for (Worker& worker : mWorkers)
+	{
+		worker.Units.clear();
+		worker.Started.clear();
+	}
+
+	mUnits.clear();
+	mPending.clear();
+	for (int y = 0; y < view.Height; y += FARM_UNIT_SIZE)
+	{
+		for (int x = 0; x < view.Width; x += FARM_UNIT_SIZE)
+		{
+			Unit unit;
+			unit.X = x;
+			unit.Y = y;
+			unit.Width = x + FARM_UNIT_SIZE < view.Width ? FARM_UNIT_SIZE : view.Width - x;
+			unit.Height = y + FARM_UNIT_SIZE < view.Height ? FARM_UNIT_SIZE : view.Height - y;
+			unit.Done = false;
+			unit.Assigned = 0;
+			mPending.push_back(static_cast<int>(mUnits.size()));
+			mUnits.push_back(unit);
+		}
+	}
+
+	int finished = 0;
+	unsigned long long busyTime = 0;
+	unsigned long long lastSeen = ::GetTickCount64();
+	while (finished < static_cast<int>(mUnits.size()))
+	{
+		AcceptWorkers();
+
+		unsigned long long now = ::GetTickCount64();
+		if (!mWorkers.empty())
+		{
+			lastSeen = now;
+		}
+		else if (now - lastSeen > CONNECT_TIMEOUT)
+		{
+			return false;
+		}
+
+		//fresh units first, once they run out idle workers double up on the slowest ones.
+		unsigned long long averageTime = finished > 0 ? busyTime / finished : 0;
+		for (size_t w = 0; w < mWorkers.size();)
+		{
+			//the job goes out before a unit is taken, so a worker found dead here holds nothing to requeue.
+			Worker& worker = mWorkers[w];
+			bool alive = worker.Units.size() >= MAX_UNITS_IN_FLIGHT || StartJob(worker, frame, view);
+			while (alive && worker.Units.size() < MAX_UNITS_IN_FLIGHT)
+			{
+				int unit = -1;
+				while (unit < 0 && !mPending.empty())
+				{
+					unit = mPending.front();
+					mPending.pop_front();
+					if (mUnits[unit].Done)
+					{
+						unit = -1;
+					}
+				}
+				if (unit < 0 && finished > 0)
+				{
+					unit = FindStraggler(worker, now, averageTime);
+				}
+				if (unit < 0)
+				{
+					break;
+				}
+
+				alive = AssignUnit(worker, unit);
+			}
+
+			if (alive)
+			{
+				w++;
+			}
+			else
+			{
+				DropWorker(static_cast<int>(w));
+			}
+		}
+
+		fd_set readable;
+		FD_ZERO(&readable);
+		for (Worker& worker : mWorkers)
+		{
+			FD_SET(worker.Socket, &readable);
+		}
+
+		timeval timeout = { 0, POLL_TIME * 1000 };
+		if (mWorkers.empty())
+		{
+			::Sleep(POLL_TIME);
+			continue;
+		}
+		if (::select(0, &readable, nullptr, nullptr, &timeout) == SOCKET_ERROR)
+		{
+			return false;
+		}
+
+		for (size_t w = 0; w < mWorkers.size();)
+		{
+			if (FD_ISSET(mWorkers[w].Socket, &readable) &&
+				!ReceiveResult(mWorkers[w], view, busyTime, finished))
+			{
+				DropWorker(static_cast<int>(w));
+				continue;
+			}
+			w++;
+		}
+	}
+	return true;
+}
+
+bool FarmCoordinator::LoadScene(const char* scenePath)
+{
+	if (scenePath == nullptr)
+	{
+		return false;
+	}
+	if (mScenePath == scenePath && !mSnapshot.empty())
+	{
+		return true;
+	}
+
+	//text scenes are converted here once, workers always receive a snapshot.
+	std::vector<unsigned char> data;
+	if (!ReadWholeFile(scenePath, data))
+	{
+		return false;
+	}
+	if (data.size() < sizeof(SnapshotHeader) || reinterpret_cast<const SnapshotHeader*>(data.data())->Magic != SNAPSHOT_MAGIC)
+	{
+		std::string snapshotPath = GetTempFile();
+		bool converted = !snapshotPath.empty() &&
+			IScene::Convert(scenePath, snapshotPath.c_str()) &&
+			ReadWholeFile(snapshotPath.c_str(), data);
+		if (!snapshotPath.empty())
+		{
+			::DeleteFileA(snapshotPath.c_str());
+		}
+		if (!converted)
+		{
+			return false;
+		}
+	}
+
+	mScenePath = scenePath;
+	mSnapshot.swap(data);
+	mSceneId++;
+	return true;
+}
+
+void FarmCoordinator::AcceptWorkers()
+{
+	while (true)
+	{
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(mListen, &readable);
+		timeval timeout = { 0, 0 };
+		if (::select(0, &readable, nullptr, nullptr, &timeout) <= 0)
+		{
+			return;
+		}
+
+		SOCKET s = ::accept(mListen, nullptr, nullptr);
+		if (s == INVALID_SOCKET)
+		{
+			return;
+		}
+
+		//results are polled with a single fd_set, which holds FD_SETSIZE sockets at most.
+		if (mWorkers.size() >= FD_SETSIZE)
+		{
+			::closesocket(s);
+			continue;
+		}
+
+		SetNoDelay(s);
+		Worker worker;
+		worker.Socket = s;
+		worker.SceneId = 0;
+		worker.JobId = 0;
+		mWorkers.push_back(worker);
+	}
+}
+
+bool FarmCoordinator::StartJob(Worker& worker, int frame, const RenderView& view)
+{
+	if (worker.JobId == mJobId)
+	{
+		return true;
+	}
+
+	JobPacket job = {};
+	job.JobId = mJobId;
+	job.Frame = frame;
+	job.Width = view.Width;
+	job.Height = view.Height;
+	for (int i = 0; i < 3; i++)
+	{
+		job.Eye[i] = view.Eye[i];
+		job.Target[i] = view.Target[i];
+		job.Up[i] = view.Up[i];
+	}
+	job.FOV = view.FOV;
+
+	bool sendScene = worker.SceneId != mSceneId;
+	job.SnapshotSize = sendScene ? static_cast<unsigned int>(mSnapshot.size()) : 0;
+	if (!SendPacket(worker.Socket, PACKET_JOB, &job, sizeof(job), mSnapshot.data(), job.SnapshotSize))
+	{
+		return false;
+	}
+
+	worker.SceneId = mSceneId;
+	worker.JobId = mJobId;
+	return true;
+}
+
+bool FarmCoordinator::AssignUnit(Worker& worker, int unit)
+{
+	//held before sending, a failed send gives the unit back when the worker is dropped.
+	const Unit& u = mUnits[unit];
+	worker.Units.push_back(unit);
+	worker.Started.push_back(::GetTickCount64());
+	mUnits[unit].Assigned++;
+
+	RegionPacket region = { mJobId, unit, u.X, u.Y, u.Width, u.Height };
+	return SendPacket(worker.Socket, PACKET_REGION, &region, sizeof(region));
+}
+
+int FarmCoordinator::FindStraggler(const Worker& worker, unsigned long long now, unsigned long long averageTime) const
+{
+	unsigned long long limit = averageTime * STRAGGLER_FACTOR;
+	if (limit < STRAGGLER_MIN_TIME)
+	{
+		limit = STRAGGLER_MIN_TIME;
+	}
+
+	int straggler = -1;
+	unsigned long long longest = limit;
+	for (const Worker& other : mWorkers)
+	{
+		if (&other == &worker)
+		{
+			continue;
+		}
+
+		for (size_t i = 0; i < other.Units.size(); i++)
+		{
+			int unit = other.Units[i];
+			unsigned long long elapsed = now - other.Started[i];
+			if (!mUnits[unit].Done && mUnits[unit].Assigned < MAX_ASSIGNMENTS && elapsed > longest &&
+				std::find(worker.Units.begin(), worker.Units.end(), unit) == worker.Units.end())
+			{
+				straggler = unit;
+				longest = elapsed;
+			}
+		}
+	}
+	return straggler;
+}
+
+bool FarmCoordinator::ReceiveResult(Worker& worker, const RenderView& view, unsigned long long& busyTime, int& finished)
+{
+	unsigned int type;
+	std::vector<unsigned char> payload;
+	if (!ReceivePacket(worker.Socket, type, payload) || type != PACKET_RESULT || payload.size() < sizeof(RegionPacket))
+	{
+		return false;
+	}
+
+	RegionPacket region;
+	memcpy(&region, payload.data(), sizeof(region));
+	if (region.JobId != mJobId)
+	{
+		return true;
+	}
+
+	//checked while the worker still holds the unit, so dropping the worker requeues it.
+	auto held = std::find(worker.Units.begin(), worker.Units.end(), region.Unit);
+	if (held == worker.Units.end())
+	{
+		return false;
+	}
+
+	Unit& unit = mUnits[region.Unit];
+	if (region.X != unit.X || region.Y != unit.Y || region.Width != unit.Width || region.Height != unit.Height ||
+		payload.size() != sizeof(RegionPacket) + unit.Width * unit.Height * 3)
+	{
+		return false;
+	}
+
+	size_t index = held - worker.Units.begin();
+	unsigned long long elapsed = ::GetTickCount64() - worker.Started[index];
+	worker.Units.erase(held);
+	worker.Started.erase(worker.Started.begin() + index);
+	unit.Assigned--;
+
+	//the first copy of a unit wins, a late backup is dropped.
+	if (!unit.Done)
+	{
+		const unsigned char* pixels = payload.data() + sizeof(RegionPacket);
+		for (int row = 0; row < unit.Height; row++)
+		{
+			memcpy(view.Buffer + (unit.Y + row) * view.Pitch + unit.X * 3, pixels + row * unit.Width * 3, unit.Width * 3);
+		}
+		unit.Done = true;
+		busyTime += elapsed;
+		finished++;
+	}
+	return true;
+}
+
+void FarmCoordinator::DropWorker(int index)
+{
+	Worker& worker = mWorkers[index];
+	::closesocket(worker.Socket);
+
+	//whatever it held goes back to the front of the queue, unless a backup still has it.
+	for (int unit : worker.Units)
+	{
+		mUnits[unit].Assigned--;
+		if (!mUnits[unit].Done && mUnits[unit].Assigned == 0)
+		{
+			mPending.push_front(unit);
+		}
+	}
+	mWorkers.erase(mWorkers.begin() + index);
+}
+
+bool RunFarmWorker(const char* host, unsigned short port)
+{
+	WSADATA data;
+	if (::WSAStartup(MAKEWORD(2, 2), &data) != 0)
+	{
+		return false;
+	}
+
+	char service[16];
+	snprintf(service, sizeof(service), "%u", static_cast<unsigned int>(port));
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	addrinfo* address = nullptr;
+	SOCKET s = INVALID_SOCKET;
+	if (::getaddrinfo(host, service, &hints, &address) == 0)
+	{
+		s = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (s != INVALID_SOCKET && ::connect(s, address->ai_addr, static_cast<int>(address->ai_addrlen)) == SOCKET_ERROR)
+		{
+			::closesocket(s);
+			s = INVALID_SOCKET;
+		}
+		::freeaddrinfo(address);
+	}
+	if (s == INVALID_SOCKET)
+	{
+		::WSACleanup();
+		return false;
+	}
+	SetNoDelay(s);
+
+	Renderer renderer;
+	IScene* scene = nullptr;
+	std::string scenePath;
+	JobPacket job = {};
+	std::vector<unsigned char> image;
+	std::vector<unsigned char> payload;
+	std::vector<unsigned char> result;
+
+	bool ok = false;
+	unsigned int type;
+	while (ReceivePacket(s, type, payload))
+	{
+		if (type == PACKET_DONE)
+		{
+			ok = true;
+			break;
+		}
+
+		if (type == PACKET_JOB)
+		{
+			if (payload.size() < sizeof(JobPacket))
+			{
+				break;
+			}
+			memcpy(&job, payload.data(), sizeof(job));
+			if (job.Width <= 0 || job.Height <= 0 || payload.size() != sizeof(JobPacket) + job.SnapshotSize)
+			{
+				break;
+			}
+
+			//the snapshot is mapped from a file, so it goes through a temporary one.
+			if (job.SnapshotSize > 0)
+			{
+				if (scene != nullptr)
+				{
+					scene->Release();
+					scene = nullptr;
+				}
+				if (scenePath.empty())
+				{
+					scenePath = GetTempFile();
+				}
+
+				std::ofstream file(scenePath, std::ios::binary | std::ios::trunc);
+				file.write(reinterpret_cast<const char*>(payload.data() + sizeof(JobPacket)), job.SnapshotSize);
+				file.close();
+				scene = file.good() ? IScene::Create(scenePath.c_str()) : nullptr;
+			}
+			if (scene == nullptr)
+			{
+				break;
+			}
+
+			scene->SetFrame(job.Frame);
+			image.resize(job.Width * job.Height * 3);
+		}
+		else if (type == PACKET_REGION)
+		{
+			RegionPacket region;
+			if (scene == nullptr || payload.size() != sizeof(RegionPacket))
+			{
+				break;
+			}
+			memcpy(&region, payload.data(), sizeof(region));
+			if (region.JobId != job.JobId || region.X < 0 || region.Y < 0 || region.Width <= 0 || region.Height <= 0 ||
+				region.X + region.Width > job.Width || region.Y + region.Height > job.Height)
+			{
+				break;
+			}
+
+			RenderView view;
+			for (int i = 0; i < 3; i++)
+			{
+				view.Eye[i] = job.Eye[i];
+				view.Target[i] = job.Target[i];
+				view.Up[i] = job.Up[i];
+			}
+			view.FOV = job.FOV;
+			view.Buffer = image.data();
+			view.Width = job.Width;
+			view.Height = job.Height;
+			view.Pitch = job.Width * 3;
+			view.RegionX = region.X;
+			view.RegionY = region.Y;
+			view.RegionWidth = region.Width;
+			view.RegionHeight = region.Height;
+
+			//noise is seeded from the frame, so every copy of a region matches a local render of it.
+			Camera camera;
+			Renderer::SetupCamera(camera, view);
+			ThreadPool::Get().ParallelFor(Renderer::GetTileCount(view), [&](int tile)
+			{
+				renderer.RenderTile(scene, camera, view, tile, static_cast<unsigned int>(job.Frame));
+			});
+
+			result.resize(region.Width * region.Height * 3);
+			for (int row = 0; row < region.Height; row++)
+			{
+				memcpy(&(result[row * region.Width * 3]), &(image[(region.Y + row) * view.Pitch + region.X * 3]), region.Width * 3);
+			}
+			if (!SendPacket(s, PACKET_RESULT, &region, sizeof(region), result.data(), result.size()))
+			{
+				break;
+			}
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if (scene != nullptr)
+	{
+		scene->Release();
+	}
+	if (!scenePath.empty())
+	{
+		::DeleteFileA(scenePath.c_str());
+	}
+	::closesocket(s);
+	::WSACleanup();
+	return ok;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <string>
+#include <winsock2.h>
+#include <irenderer.h>
+
+//splits frames into regions and renders them on worker processes, which connect over
+//tcp and may run on this machine or elsewhere. workers get the scene as a snapshot
+//file, so they load it without parsing or building the top level tree.
+class FarmCoordinator
+{
+public:
+	FarmCoordinator() = default;
+
+	~FarmCoordinator();
+
+	FarmCoordinator(const FarmCoordinator&) = delete;
+	FarmCoordinator& operator = (const FarmCoordinator&) = delete;
+
+	bool Listen(unsigned short port);
+
+	//runs more copies of this executable in worker mode, connecting back to the listening port.
+	bool SpawnLocalWorkers(int count);
+
+	//renders one frame of a scene file as seen by view into view.Buffer, the region fields are ignored.
+	bool Render(const char* scenePath, int frame, const RenderView& view);
+
+private:
+	struct Unit
+	{
+		int X, Y, Width, Height;	//image rows from the top, like RenderView regions
+		bool Done;
+		int Assigned;	//workers currently holding the unit
+	};
+
+	struct Worker
+	{
+		SOCKET Socket;
+		int SceneId;	//scene the worker has loaded, the snapshot is sent once per scene
+		int JobId;
+		std::vector<int> Units;
+		std::vector<unsigned long long> Started;
+	};
+
+	bool LoadScene(const char* scenePath);
+	void AcceptWorkers();
+	bool StartJob(Worker& worker, int frame, const RenderView& view);
+	bool AssignUnit(Worker& worker, int unit);
+	int FindStraggler(const Worker& worker, unsigned long long now, unsigned long long averageTime) const;
+	bool ReceiveResult(Worker& worker, const RenderView& view, unsigned long long& busyTime, int& finished);
+	void DropWorker(int index);
+
+	SOCKET mListen = INVALID_SOCKET;
+	unsigned short mPort = 0;
+	bool mStarted = false;
+	std::vector<HANDLE> mProcesses;
+	std::vector<Worker> mWorkers;
+
+	std::string mScenePath;
+	std::vector<unsigned char> mSnapshot;
+	int mSceneId = 0;
+	int mJobId = 0;
+
+	std::vector<Unit> mUnits;
+	std::deque<int> mPending;
+};
+
+//worker side, serves one coordinator until it says it is done or the connection drops.
+bool RunFarmWorker(const char* host, unsigned short port);
@@ -0,0 +1,263 @@
+#include "pch.h"
+#include "renderservice.h"
+#include "threadpool.h"
+
+IRenderService* IRenderService::Create()
+{
+	return new RenderService();
+}
+
+IRenderService::~IRenderService()
+{
+
+}
+
+void IRenderService::Release()
+{
+	delete this;
+}
+
+IRenderJob::~IRenderJob()
+{
+
+}
+
+RenderJob::RenderJob(const RenderJobDesc& desc, unsigned int frameIndex)
+	: mDesc(desc)
+	, mFrameIndex(frameIndex)
+	, mTileCount(Renderer::GetTileCount(desc.View))
+	, mRefs(1)
+{
+	Renderer::SetupCamera(mCamera, desc.View);
+}
+
+void RenderJob::Release()
+{
+	if (--mRefs == 0)
+	{
+		delete this;
+	}
+}
+
+void RenderJob::Cancel()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mState == RenderJobState::Completed || mState == RenderJobState::Cancelled)
+	{
+		return;
+	}
+
+	mCancelled = true;
+	if (mInFlight == 0)
+	{
+		Finish(RenderJobState::Cancelled);
+	}
+}
+
+RenderJobState RenderJob::GetState() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mState;
+}
+
+RenderJobState RenderJob::Wait()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mFinished.wait(lock, [this] { return mState == RenderJobState::Completed || mState == RenderJobState::Cancelled; });
+	return mState;
+}
+
+bool RenderJob::BeginTile()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mCancelled)
+	{
+		return false;
+	}
+
+	mInFlight++;
+	mState = RenderJobState::Running;
+	return true;
+}
+
+void RenderJob::EndTile()
+{
+	int done;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		done = ++mDoneTiles;
+	}
+
+	//the tile still counts as in flight here, so Wait does not return before the callback.
+	if (mDesc.Progress)
+	{
+		mDesc.Progress(done, mTileCount);
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (--mInFlight == 0)
+	{
+		if (mDoneTiles == mTileCount)
+		{
+			Finish(RenderJobState::Completed);
+		}
+		else if (mCancelled)
+		{
+			Finish(RenderJobState::Cancelled);
+		}
+	}
+}
+
+void RenderJob::Finish(RenderJobState state)
+{
+	mState = state;
+	mFinished.notify_all();
+}
+
+RenderService::~RenderService()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	for (RenderJob* job : mJobs)
+	{
+		job->Cancel();
+	}
+
+	//queued pool items still point at the service, they find nothing left to do and leave.
+	mIdle.wait(lock, [this] { return mSlots == 0; });
+	for (RenderJob* job : mJobs)
+	{
+		job->Release();
+	}
+	mJobs.clear();
+}
+
+void RenderService::SetLightSampleCount(int count)
+{
+	mRenderer.SetLightSampleCount(count);
+}
+
+IRenderJob* RenderService::Submit(const RenderJobDesc& desc)
+{
+	if (desc.Scene == nullptr || desc.View.Buffer == nullptr)
+	{
+		return nullptr;
+	}
+
+	ThreadPool& pool = ThreadPool::Get();
+	int workers = pool.GetThreadCount() - 1;
+	int slots = 0;
+	RenderJob* job;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		job = new RenderJob(desc, ++mFrameIndex);
+		if (job->mTileCount == 0)
+		{
+			job->Finish(RenderJobState::Completed);
+			return job;
+		}
+
+		job->AddRef();
+		job->mLastServed = mServeCount;
+		mJobs.push_back(job);
+
+		//one pool item per worker, each renders a tile and queues its successor.
+		int wanted = workers > 0 ? workers : 1;
+		if (mSlots < wanted)
+		{
+			slots = wanted - mSlots;
+			mSlots = wanted;
+		}
+	}
+
+	if (workers == 0)
+	{
+		//nobody else would pick the items up, render on the calling thread instead.
+		while (slots > 0 && RunTile())
+		{
+		}
+	}
+	else
+	{
+		pool.Post(slots, [this](int)
+		{
+			RunSlot();
+		});
+	}
+	return job;
+}
+
+RenderJob* RenderService::PickTile(int& tile)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	while (true)
+	{
+		//highest priority first, among equals the job that waited longest for a tile.
+		size_t best = mJobs.size();
+		for (size_t i = 0; i < mJobs.size(); i++)
+		{
+			if (best == mJobs.size() ||
+				mJobs[i]->mDesc.Priority > mJobs[best]->mDesc.Priority ||
+				(mJobs[i]->mDesc.Priority == mJobs[best]->mDesc.Priority && mJobs[i]->mLastServed < mJobs[best]->mLastServed))
+			{
+				best = i;
+			}
+		}
+
+		if (best == mJobs.size())
+		{
+			mSlots--;
+			mIdle.notify_all();
+			return nullptr;
+		}
+
+		RenderJob* job = mJobs[best];
+		bool started = job->BeginTile();
+		tile = job->mNextTile++;
+
+		//the queue's reference moves to the last tile, or goes away with a cancelled job.
+		if (!started || job->mNextTile == job->mTileCount)
+		{
+			mJobs.erase(mJobs.begin() + best);
+			if (!started)
+			{
+				job->Release();
+				continue;
+			}
+		}
+		else
+		{
+			job->AddRef();
+		}
+
+		job->mLastServed = ++mServeCount;
+		return job;
+	}
+}
+
+bool RenderService::RunTile()
+{
+	int tile;
+	RenderJob* job = PickTile(tile);
+	if (job == nullptr)
+	{
+		return false;
+	}
+
+	mRenderer.RenderTile(job->mDesc.Scene, job->mCamera, job->mDesc.View, tile, job->mFrameIndex);
+	job->EndTile();
+	job->Release();
+	return true;
+}
+
+void RenderService::RunSlot()
+{
+	//a single tile per pool item, so jobs submitted meanwhile and other users of the pool
+	//get their turn between tiles.
+	if (RunTile())
+	{
+		ThreadPool::Get().Post(1, [this](int)
+		{
+			RunSlot();
+		});
+	}
+}
\ No newline at end of file
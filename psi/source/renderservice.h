@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <irenderservice.h>
+#include "renderer.h"
+#include "camera.h"
+
+class RenderJob : public IRenderJob
+{
+public:
+	RenderJob(const RenderJobDesc& desc, unsigned int frameIndex);
+
+	virtual void Release();
+
+	virtual void Cancel();
+
+	virtual RenderJobState GetState() const;
+
+	virtual RenderJobState Wait();
+
+private:
+	friend class RenderService;
+
+	inline void AddRef() { mRefs++; }
+
+	//false once the job is cancelled, otherwise counts a tile in flight.
+	bool BeginTile();
+
+	//reports progress, the last tile in flight ends the job.
+	void EndTile();
+
+	void Finish(RenderJobState state);
+
+	RenderJobDesc mDesc;
+	Camera mCamera;
+	unsigned int mFrameIndex;
+	int mTileCount;
+	std::atomic<int> mRefs;
+
+	//scheduler state, guarded by the service.
+	int mNextTile = 0;
+	unsigned long long mLastServed = 0;
+
+	mutable std::mutex mMutex;
+	std::condition_variable mFinished;
+	RenderJobState mState = RenderJobState::Queued;
+	bool mCancelled = false;
+	int mInFlight = 0;
+	int mDoneTiles = 0;
+};
+
+class RenderService : public IRenderService
+{
+public:
+	RenderService() = default;
+
+	~RenderService();
+
+	virtual void SetLightSampleCount(int count);
+
+	virtual IRenderJob* Submit(const RenderJobDesc& desc);
+
+private:
+	RenderJob* PickTile(int& tile);
+	bool RunTile();
+	void RunSlot();
+
+	Renderer mRenderer;
+	unsigned int mFrameIndex = 0;
+
+	std::mutex mMutex;
+	std::condition_variable mIdle;
+	std::vector<RenderJob*> mJobs;	//jobs with tiles left to start, each holding a reference
+	int mSlots = 0;	//pool items queued or running for the service
+	unsigned long long mServeCount = 0;
+};
\ No newline at end of file
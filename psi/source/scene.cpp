@@ -1,11 +1,31 @@
 #include "pch.h"
+#include <math.h>
 #include <isceneobject.h>
 #include "scene.h"
+#include "sceneobject.h"
+#include "bvh4.h"
 
 
-IScene* IScene::Create()
+IScene* IScene::Create(SceneAccelerator accelerator)
 {
-	return new Scene();
+	return new Scene(accelerator);
+}
+
+IScene* IScene::Create(const char* path)
+{
+	Scene* scene = new Scene();
+	if (!scene->Load(path))
+	{
+		scene->Release();
+		return nullptr;
+	}
+	return scene;
+}
+
+bool IScene::Convert(const char* textPath, const char* snapshotPath)
+{
+	SceneDescription desc;
+	return ParseSceneText(textPath, desc) && WriteSnapshot(snapshotPath, desc);
 }
 
 IScene::~IScene()
@@ -18,13 +38,95 @@ void IScene::Release()
 	delete this;
 }
 
-SceneNode* SceneNode::CreateRoot(float width, float height, float depth)
+namespace
+{
+	const int MAX_OCTREE_LEVEL = 10;
+
+	gml::vec3 GetHalfSize(const gml::aabb& aabb)
+	{
+		return (aabb.max_bound() - aabb.min_bound()) * 0.5f;
+	}
+
+	float MaxComponent(const gml::vec3& v)
+	{
+		return (v.x > v.y) ? (v.x > v.z ? v.x : v.z) : (v.y > v.z ? v.y : v.z);
+	}
+
+	bool IsSection(size_t fileSize, unsigned int offset, int count, size_t elementSize)
+	{
+		return count >= 0 && offset % SNAPSHOT_ALIGNMENT == 0 && offset <= fileSize &&
+			static_cast<size_t>(count) <= (fileSize - offset) / elementSize;
+	}
+
+	gml::vec3 ParticlePosition(int index, float phase)
+	{
+		const float pi2 = 3.141592653f * 2.0f;
+		const float GOLDEN_ANGLE = 2.399963f;
+
+		float angle = index * GOLDEN_ANGLE + phase * pi2;
+		float radius = 8.0f + (index % 37) * 0.6f;
+		float height = (index % 101) * 0.3f - 14.0f;
+		return gml::vec3(radius * cos(angle), height, -60.0f + radius * sin(angle));
+	}
+}
+
+SceneNode* SceneNode::CreateRoot(const std::vector<ISceneObject*>& objects, Arena& arena)
 {
-	SceneNode* node = new SceneNode();
-	node->mAABB.expand(gml::vec3(-width, -height, -depth));
-	node->mAABB.expand(gml::vec3(+width, +height, +depth));
+	//infinite objects (planes) stay in root, the rest decides the tree shape.
+	std::vector<ISceneObject*> bounded;
+	std::vector<ISceneObject*> unbounded;
+	gml::aabb sceneAABB;
+	float objectSize = 0.0f;
+	for (ISceneObject* obj : objects)
+	{
+		const gml::aabb& aabb = obj->GetAABB();
+		if (IsBounded(aabb))
+		{
+			bounded.push_back(obj);
+			sceneAABB.expand(aabb.min_bound());
+			sceneAABB.expand(aabb.max_bound());
+			objectSize += MaxComponent(GetHalfSize(aabb));
+		}
+		else
+		{
+			unbounded.push_back(obj);
+		}
+	}
+
+	SceneNode* node = new (arena.Allocate(sizeof(SceneNode), alignof(SceneNode))) SceneNode();
+	if (bounded.empty())
+	{
+		node->SetBounds(gml::vec3(0, 0, 0), gml::vec3(1, 1, 1));
+		node->SetObjects(unbounded, arena);
+		return node;
+	}
+
+	gml::vec3 halfSize = GetHalfSize(sceneAABB);
+	node->SetBounds(sceneAABB.center(), halfSize);
+
+	//leaf size grows slowly with object count, depth stops when
+	//leaves would run empty or cells get smaller than an average object.
+	int count = static_cast<int>(bounded.size());
+	int leafSize = 2 + static_cast<int>(log2(count + 1.0)) / 2;
+	int countLevel = static_cast<int>(ceil(log(count / static_cast<double>(leafSize)) / log(8.0)));
+
+	objectSize /= count;
+	int sizeLevel = MAX_OCTREE_LEVEL;
+	if (objectSize > 0.0f)
+	{
+		sizeLevel = static_cast<int>(floor(log2(MaxComponent(halfSize) / objectSize)));
+	}
+
+	int maxLevel = countLevel < sizeLevel ? countLevel : sizeLevel;
+	if (maxLevel < 0)					maxLevel = 0;
+	if (maxLevel > MAX_OCTREE_LEVEL)	maxLevel = MAX_OCTREE_LEVEL;
+
+	node->Build(bounded, maxLevel, leafSize, arena);
+	bounded.insert(bounded.end(), unbounded.begin(), unbounded.end());
+	node->SetObjects(bounded, arena);
 	return node;
 }
+
 SceneNode::SceneNode(SceneNode* parent, int level) : mParent(parent), mLevel(level)
 {
 	for (int i = 0; i < 8; i++)
@@ -33,131 +135,179 @@ SceneNode::SceneNode(SceneNode* parent, int level) : mParent(parent), mLevel(lev
 	}
 }
 
-SceneNode::~SceneNode()
+void SceneNode::SetBounds(const gml::vec3& center, const gml::vec3& halfSize)
 {
-	for (int i = 0; i < 8; i++)
-	{
-		if (mChildren[i] != nullptr)
-		{
-			mChildren[i]->Release();
-		}
-	}
+	mCenter = center;
+	mHalfSize = halfSize;
+	mLooseAABB.expand(center - halfSize * 2.0f);
+	mLooseAABB.expand(center + halfSize * 2.0f);
+}
 
-	for (int i = 0, length = mObjects.size(); i < length; ++i)
+void SceneNode::SetObjects(const std::vector<ISceneObject*>& objects, Arena& arena)
+{
+	mObjectCount = static_cast<int>(objects.size());
+	mObjects = arena.NewArray<ISceneObject*>(mObjectCount);
+	for (int i = 0; i < mObjectCount; i++)
 	{
-		mObjects[i]->Release();
+		mObjects[i] = objects[i];
 	}
-
 }
 
-void SceneNode::Release()
+int SceneNode::GetChildIndex(const gml::vec3& position) const
 {
-	delete this;
+	return (position.x > mCenter.x ? 1 : 0) |
+		(position.y > mCenter.y ? 2 : 0) |
+		(position.z > mCenter.z ? 4 : 0);
 }
 
-bool SceneNode::Add(ISceneObject* obj)
+//objects that stay in this node are left in objects.
+void SceneNode::Build(std::vector<ISceneObject*>& objects, int maxLevel, int leafSize, Arena& arena)
 {
-	const gml::aabb& aabb = obj->GetAABB();
-	if (mAABB.is_intersect(aabb) != gml::it_none)
+	if (mLevel >= maxLevel || static_cast<int>(objects.size()) <= leafSize)
+	{
+		return;
+	}
+
+	//an object goes down when it fits the loose bounds of the child holding its center,
+	//that is when its half size is no larger than half of the child cell.
+	gml::vec3 childHalfSize = mHalfSize * 0.5f;
+	std::vector<ISceneObject*> childObjects[8];
+	std::vector<ISceneObject*> ownObjects;
+	for (ISceneObject* obj : objects)
 	{
-		if (mParent == nullptr)
+		const gml::aabb& aabb = obj->GetAABB();
+		gml::vec3 halfSize = GetHalfSize(aabb);
+		if (halfSize.x <= childHalfSize.x &&
+			halfSize.y <= childHalfSize.y &&
+			halfSize.z <= childHalfSize.z)
 		{
-			mObjects.push_back(obj);
-			return true;
+			childObjects[GetChildIndex(aabb.center())].push_back(obj);
 		}
 		else
 		{
-			return false;
+			ownObjects.push_back(obj);
 		}
 	}
-	else
+	objects.swap(ownObjects);
+
+	for (int i = 0; i < 8; i++)
 	{
-		if (mLevel < 3)
+		if (childObjects[i].empty())
 		{
-			for (int i = 0; i < 8; i++)
-			{
-				if (mChildren[i] == nullptr)
-				{
-					gml::aabb aabb = GenerateChildAABB(i);
-					if (aabb.is_intersect(obj->GetAABB()) == gml::it_contain)
-					{
-						mChildren[i] = new SceneNode(this, mLevel + 1);
-						mChildren[i]->mAABB = aabb;
-					}
-				}
-
-				if (mChildren[i] != nullptr && mChildren[i]->Add(obj))
-				{
-					return true;
-				}
-			}
+			continue;
 		}
 
-		mObjects.push_back(obj);
-		return true;
+		gml::vec3 offset(
+			(i & 1) ? childHalfSize.x : -childHalfSize.x,
+			(i & 2) ? childHalfSize.y : -childHalfSize.y,
+			(i & 4) ? childHalfSize.z : -childHalfSize.z);
+
+		mChildren[i] = new (arena.Allocate(sizeof(SceneNode), alignof(SceneNode))) SceneNode(this, mLevel + 1);
+		mChildren[i]->SetBounds(mCenter + offset, childHalfSize);
+		mChildren[i]->Build(childObjects[i], maxLevel, leafSize, arena);
+		mChildren[i]->SetObjects(childObjects[i], arena);
 	}
 }
 
-gml::aabb SceneNode::GenerateChildAABB(int index)
+ISceneObject* SceneNode::IntersectWithRay(const gml::ray& ray, HitInfo& info, ISceneObject* exclude) const
 {
-	gml::aabb aabb;
-	aabb.expand(mAABB.center());
-	gml::vec3 v;
-	switch (index)
-	{
-	case 0:v.set(mAABB.min_bound().x, mAABB.min_bound().y, mAABB.min_bound().z); break;
-	case 1:v.set(mAABB.max_bound().x, mAABB.min_bound().y, mAABB.min_bound().z); break;
-	case 2:v.set(mAABB.min_bound().x, mAABB.max_bound().y, mAABB.min_bound().z); break;
-	case 3:v.set(mAABB.max_bound().x, mAABB.max_bound().y, mAABB.min_bound().z); break;
-	case 4:v.set(mAABB.min_bound().x, mAABB.min_bound().y, mAABB.max_bound().z); break;
-	case 5:v.set(mAABB.max_bound().x, mAABB.min_bound().y, mAABB.max_bound().z); break;
-	case 6:v.set(mAABB.min_bound().x, mAABB.max_bound().y, mAABB.max_bound().z); break;
-	case 7:v.set(mAABB.max_bound().x, mAABB.max_bound().y, mAABB.max_bound().z); break;
-	}
-	aabb.expand(v);
-	return aabb;
+	return IntersectWithRay(ray, ray.direction().inversed(), info, exclude);
 }
 
-ISceneObject* SceneNode::IntersectWithRay(const gml::ray& ray, HitInfo& info, ISceneObject* exclude) const
+ISceneObject* SceneNode::IntersectWithRay(const gml::ray& ray, const gml::vec3& invDir, HitInfo& info, ISceneObject* exclude) const
 {
-	if (mParent == nullptr || Intersect(ray, mAABB) > 0)
+	ISceneObject* hitObject = nullptr;
+	for (int i = 0; i < mObjectCount; ++i)
 	{
-		ISceneObject* hitObject = nullptr;
-		for (int i = 0, length = mObjects.size(); i < length; ++i)
+		ISceneObject* object = mObjects[i];
+		if (object == exclude)
+			continue;
+
+		if (object->IntersectWithRay(ray, info.t, info))
 		{
-			ISceneObject* object = mObjects[i];
-			if (object == exclude)
-				continue;
+			hitObject = object;
+		}
+	}
 
-			if (object->IntersectWithRay(ray, info.t, info))
+	//sort children by entry distance, near hits shrink info.t before far children are tested.
+	const SceneNode* children[8];
+	float entries[8];
+	int count = 0;
+	for (int c = 0; c < 8; c++)
+	{
+		float entry;
+		const SceneNode* child = mChildren[c];
+		if (child != nullptr && Intersect(ray, invDir, child->mLooseAABB, info.t, entry))
+		{
+			int i = count++;
+			for (; i > 0 && entries[i - 1] > entry; i--)
 			{
-				hitObject = object;
+				children[i] = children[i - 1];
+				entries[i] = entries[i - 1];
 			}
+			children[i] = child;
+			entries[i] = entry;
 		}
+	}
 
-		ISceneObject* testHitObject = nullptr;
-		for (int c = 0; c < 8; c++)
+	for (int i = 0; i < count && entries[i] <= info.t; i++)
+	{
+		ISceneObject* testHitObject = children[i]->IntersectWithRay(ray, invDir, info, exclude);
+		if (testHitObject != nullptr)
 		{
-			if (mChildren[c] != nullptr)
-			{
-				testHitObject = mChildren[c]->IntersectWithRay(ray, info, exclude);
-				if (testHitObject != nullptr)
-				{
-					hitObject = testHitObject;
-				}
-			}
+			hitObject = testHitObject;
 		}
+	}
 
-		return hitObject;
+	return hitObject;
+}
+
+//children hold their objects inside their loose bounds, so a rejected child is skipped as a whole.
+bool SceneNode::QueryObjects(const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count) const
+{
+	for (int i = 0; i < mObjectCount; ++i)
+	{
+		if (!AddQueryObject(mObjects[i], filter, objects, maxCount, count))
+		{
+			return false;
+		}
+	}
+
+	for (int c = 0; c < 8; c++)
+	{
+		const SceneNode* child = mChildren[c];
+		if (child != nullptr && filter.Overlaps(child->mLooseAABB) && !child->QueryObjects(filter, objects, maxCount, count))
+		{
+			return false;
+		}
 	}
-	return nullptr;
+	return true;
+}
+
+void Octree::Build(const std::vector<ISceneObject*>& objects)
+{
+	mArena.Reset();
+	mRoot = SceneNode::CreateRoot(objects, mArena);
+}
+
+ISceneObject* Octree::IntersectWithRay(const gml::ray& ray, HitInfo& info, ISceneObject* exclude) const
+{
+	return mRoot->IntersectWithRay(ray, info, exclude);
+}
+
+bool Octree::QueryObjects(const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count) const
+{
+	return mRoot->QueryObjects(filter, objects, maxCount, count);
 }
 
 
 Scene::Scene()
 {
-	mSceneRoot = SceneNode::CreateRoot(200, 200, 200);
 
+}
+
+Scene::Scene(SceneAccelerator accelerator)
+{
 	if (1)		//sphere
 	{
 		const int LINE_COUNT = 2;
@@ -171,10 +321,10 @@ Scene::Scene()
 			for (int j = 0; j < LINE_COUNT; ++j)
 			{
 				{
-					ISceneObject* sphere = ISceneObject::CreateSphere(gml::vec3(offset + i * INTERVAL, offset + j * INTERVAL, (j % 2) * -10.0f - 60.0f + offset), SIZE);
+					ISceneObject* sphere = mArena.New<SphereSceneObject>(gml::vec3(offset + i * INTERVAL, offset + j * INTERVAL, (j % 2) * -10.0f - 60.0f + offset), SIZE);
 					sphere->GetMaterial()->IsReflective = i % 2 == 0;
 					sphere->GetMaterial()->IsTransparent = j % 2 == 0;
-					mSceneRoot->Add(sphere);
+					mObjects.push_back(sphere);
 				}
 			}
 		}
@@ -182,37 +332,64 @@ Scene::Scene()
 
 	if (1)		//box
 	{
-		ISceneObject* box = ISceneObject::CreateBox(gml::vec3(-30, -10, -90), gml::vec3(4, 2, 7));
-		mSceneRoot->Add(box);
+		ISceneObject* box = mArena.New<BoxSceneObject>(gml::vec3(-30, -10, -90), gml::vec3(4, 2, 7));
+		mObjects.push_back(box);
 	}
 
 	if (1)		//pyramid
 	{
-		ISceneObject* pyramid = ISceneObject::CreatePyramid(gml::vec3(20, 5, -65), 4);
-		mSceneRoot->Add(pyramid);
+		ISceneObject* pyramid = mArena.New<PyramidSceneObject>(gml::vec3(20, 5, -65), 4);
+		mObjects.push_back(pyramid);
 	}
 
 	if (0)		//model
 	{
-		ISceneObject* model = ISceneObject::CreateModel(gml::vec3(-5, -15, -90), 2.5f);
-		mSceneRoot->Add(model);
+		ISceneObject* model = mArena.New<ModelSceneObject>(GetTeapotMesh(), gml::vec3(-5, -15, -90), 2.5f, 0.0f);
+		mObjects.push_back(model);
+	}
+
+	if (0)		//instances
+	{
+		const int LINE_COUNT = 20;
+		const float INTERVAL = 4.0f;
+
+		float offset = -(LINE_COUNT - 1) * 0.5f * INTERVAL;
+		for (int i = 0; i < LINE_COUNT; ++i)
+		{
+			for (int j = 0; j < LINE_COUNT; ++j)
+			{
+				ISceneObject* model = mArena.New<ModelSceneObject>(GetTeapotMesh(), gml::vec3(offset + i * INTERVAL, -15, -70 + offset + j * INTERVAL), 1.0f, (i * LINE_COUNT + j) * 0.7f);
+				mObjects.push_back(model);
+			}
+		}
+	}
+
+	if (0)		//particles
+	{
+		const int PARTICLE_COUNT = 2000;
+		for (int i = 0; i < PARTICLE_COUNT; ++i)
+		{
+			ISceneObject* particle = mArena.New<SphereSceneObject>(ParticlePosition(i, 0.0f), 0.3f);
+			mParticles.push_back(particle);
+			mObjects.push_back(particle);
+		}
 	}
 
 	if (1)		//wall
 	{
 		ISceneObject* wall;
 
-		wall = ISceneObject::CreatePlane(gml::vec3(0, 0, -100), gml::vec3(0, 0, 1));
-		mSceneRoot->Add(wall);
+		wall = mArena.New<PlaneSceneObject>(gml::vec3(0, 0, -100), gml::vec3(0, 0, 1));
+		mObjects.push_back(wall);
 
-		wall = ISceneObject::CreatePlane(gml::vec3(-40, 0, 0), gml::vec3(1, 0, 0));
-		mSceneRoot->Add(wall);
+		wall = mArena.New<PlaneSceneObject>(gml::vec3(-40, 0, 0), gml::vec3(1, 0, 0));
+		mObjects.push_back(wall);
 
-		wall = ISceneObject::CreatePlane(gml::vec3(40, 0, 0), gml::vec3(-1, 0, 0));
-		mSceneRoot->Add(wall);
+		wall = mArena.New<PlaneSceneObject>(gml::vec3(40, 0, 0), gml::vec3(-1, 0, 0));
+		mObjects.push_back(wall);
 
-		wall = ISceneObject::CreatePlane(gml::vec3(0, -15, 0), gml::vec3(0, 1, 0));
-		mSceneRoot->Add(wall);
+		wall = mArena.New<PlaneSceneObject>(gml::vec3(0, -15, 0), gml::vec3(0, 1, 0));
+		mObjects.push_back(wall);
 	}
 
 	//light
@@ -224,31 +401,136 @@ Scene::Scene()
 	mLights[1].Position.set(0, 50, -60);
 	mLights[1].Intensity = 0.75f;
 
+	if (0)		//many lights
+	{
+		const int LIGHT_COUNT = 256;
+		for (int i = 0; i < LIGHT_COUNT; ++i)
+		{
+			Light light;
+			light.Position.set((i % 16) * 5.0f - 37.5f, (i / 16 % 4) * 8.0f - 10.0f, (i / 64) * -12.0f - 50.0f);
+			light.Color.set(0.3f + (i % 3) * 0.3f, 0.3f + (i % 5) * 0.15f, 0.3f + (i % 7) * 0.1f);
+			light.Intensity = 0.4f;
+			light.Range = 20.0f;
+			mLights.push_back(light);
+		}
+	}
+	mLightTree.Build(&(mLights[0]), mLights.size());
+
 	mRandomSeed = 0.5f;
+	mAnimateLight = true;
+
+	mAccelerator = Accelerator::Create(accelerator);
+	mAccelerator->Build(mObjects);
 }
 
 Scene::~Scene()
 {
-	mSceneRoot->Release();
+	if (mAccelerator != nullptr)
+	{
+		mAccelerator->Release();
+	}
+}
+
+bool Scene::Load(const char* path)
+{
+	if (mSnapshot.Open(path))
+	{
+		if (mSnapshot.GetSize() >= sizeof(SnapshotHeader) &&
+			reinterpret_cast<const SnapshotHeader*>(mSnapshot.GetData())->Magic == SNAPSHOT_MAGIC)
+		{
+			return LoadSnapshot();
+		}
+		mSnapshot.Close();
+	}
+
+	SceneDescription desc;
+	if (!ParseSceneText(path, desc))
+	{
+		return false;
+	}
+
+	for (const ObjectRecord& record : desc.Objects)
+	{
+		mObjects.push_back(CreateSceneObject(record, mArena));
+	}
+	SetLights(desc.Lights.data(), static_cast<int>(desc.Lights.size()));
+	mAmbientColor.set(desc.Ambient[0], desc.Ambient[1], desc.Ambient[2]);
+
+	mAccelerator = Accelerator::Create(SceneAccelerator::Bvh4);
+	mAccelerator->Build(mObjects);
+	return true;
+}
+
+bool Scene::LoadSnapshot()
+{
+	const unsigned char* data = mSnapshot.GetData();
+	size_t size = mSnapshot.GetSize();
+	const SnapshotHeader& header = *reinterpret_cast<const SnapshotHeader*>(data);
+	if (header.Version != SNAPSHOT_VERSION || header.FileSize != size || header.NodeSize != Bvh4::GetNodeSize() ||
+		!IsSection(size, header.ObjectOffset, header.ObjectCount, sizeof(ObjectRecord)) ||
+		!IsSection(size, header.LightOffset, header.LightCount, sizeof(LightRecord)) ||
+		!IsSection(size, header.NodeOffset, header.NodeCount, header.NodeSize) ||
+		!IsSection(size, header.PrimitiveOffset, header.PrimitiveCount, sizeof(int)))
+	{
+		return false;
+	}
+
+	//objects need their vtables, so they are constructed from the records, next to each other in the arena.
+	const ObjectRecord* records = reinterpret_cast<const ObjectRecord*>(data + header.ObjectOffset);
+	mObjects.reserve(header.ObjectCount);
+	for (int i = 0; i < header.ObjectCount; i++)
+	{
+		ISceneObject* object = CreateSceneObject(records[i], mArena);
+		if (object == nullptr)
+		{
+			return false;
+		}
+		mObjects.push_back(object);
+	}
+
+	SetLights(reinterpret_cast<const LightRecord*>(data + header.LightOffset), header.LightCount);
+	mAmbientColor.set(header.Ambient[0], header.Ambient[1], header.Ambient[2]);
+
+	//nodes and primitive ids stay in the mapped file.
+	Bvh4Accelerator* accelerator = new Bvh4Accelerator();
+	mAccelerator = accelerator;
+	return accelerator->Attach(mObjects, data + header.NodeOffset, header.NodeCount,
+		reinterpret_cast<const int*>(data + header.PrimitiveOffset), header.PrimitiveCount);
+}
+
+void Scene::SetLights(const LightRecord* lights, int count)
+{
+	mLights.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		mLights[i].Position.set(lights[i].Position[0], lights[i].Position[1], lights[i].Position[2]);
+		mLights[i].Color.set(lights[i].Color[0], lights[i].Color[1], lights[i].Color[2]);
+		mLights[i].Intensity = lights[i].Intensity;
+		mLights[i].Range = lights[i].Range;
+	}
+	mLightTree.Build(GetLightList(), count);
 }
 
 
 ISceneObject* Scene::IntersectWithRay(const gml::ray&ray, HitInfo& info, ISceneObject* exclude) const
 {
 	info.t = FLT_MAX;
-	return mSceneRoot->IntersectWithRay(ray, info, exclude);
+	return mAccelerator->IntersectWithRay(ray, info, exclude);
 }
 
 void Scene::Update()
+{
+	SetFrame(mFrame + 1);
+}
+
+void Scene::SetFrame(int frame)
 {
 	const float pi2 = 3.141592653f * 2.0f;
 	const float R = 35.0f;
 
-	mRandomSeed += 0.005f;
-	if (mRandomSeed > 1.0f)
-	{
-		mRandomSeed -= 1.0f;
-	}
+	//derived from the frame number alone, so frames can be set in any order.
+	mFrame = frame;
+	mRandomSeed = static_cast<float>(fmod(0.5 + frame * 0.005, 1.0));
 
 	float radius = pi2 * mRandomSeed;
 
@@ -256,12 +538,42 @@ void Scene::Update()
 	float sins = R * sin(radius);
 
 
-	mLights[0].Position.set(coss, 0, -50 + sins);
+	if (mAnimateLight)
+	{
+		mLights[0].Position.set(coss, 0, -50 + sins);
+		mLightTree.Build(&(mLights[0]), mLights.size());
+	}
+
+	//moving objects invalidate the accelerator, rebuild it every frame.
+	if (!mParticles.empty())
+	{
+		for (int i = 0, length = mParticles.size(); i < length; ++i)
+		{
+			mParticles[i]->SetPosition(ParticlePosition(i, mRandomSeed));
+		}
+		mAccelerator->Build(mObjects);
+	}
+}
+
+int Scene::GetObjectCount() const
+{
+	return mObjects.size();
+}
+
+ISceneObject* Scene::GetSceneObject(int index) const
+{
+	return mObjects[index];
+}
+
+bool Scene::QueryObjects(const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count) const
+{
+	count = 0;
+	return mAccelerator->QueryObjects(filter, objects, maxCount, count);
 }
 
 const Light* Scene::GetLightList() const
 {
-	return &(mLights[0]);
+	return mLights.empty() ? nullptr : &(mLights[0]);
 }
 
 int Scene::GetLightCount() const
@@ -269,6 +581,11 @@ int Scene::GetLightCount() const
 	return mLights.size();
 }
 
+int Scene::SampleLight(const gml::vec3& position, float u, float& pdf) const
+{
+	return mLightTree.Sample(position, u, pdf);
+}
+
 const gml::color3& Scene::GetAmbientColor() const
 {
 	return mAmbientColor;
@@ -1,33 +1,55 @@
 #pragma once
 #include <vector>
 #include <iscene.h>
+#include "accelerator.h"
 #include "geometry.h"
+#include "lighttree.h"
+#include "scenefile.h"
+#include "arena.h"
 #include <gmlaabb.h>
 #include <gmlcolor.h>
 
+//nodes and their object lists live in the arena of the octree.
 class SceneNode
 {
 public:
-	static SceneNode* CreateRoot(float width, float height, float depth);
-
-	~SceneNode();
-
-	bool Add(ISceneObject* obj);
+	static SceneNode* CreateRoot(const std::vector<ISceneObject*>& objects, Arena& arena);
 
 	ISceneObject* IntersectWithRay(const gml::ray& ray, HitInfo& info, ISceneObject* exclude) const;
 
-	void Release();
+	bool QueryObjects(const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count) const;
 
 private:
 	SceneNode(SceneNode* parent = nullptr, int level = 0);
-	gml::aabb GenerateChildAABB(int index);
-
-	gml::aabb mAABB;
-	int mLevel;
+	void SetBounds(const gml::vec3& center, const gml::vec3& halfSize);
+	void SetObjects(const std::vector<ISceneObject*>& objects, Arena& arena);
+	void Build(std::vector<ISceneObject*>& objects, int maxLevel, int leafSize, Arena& arena);
+	int GetChildIndex(const gml::vec3& position) const;
+	ISceneObject* IntersectWithRay(const gml::ray& ray, const gml::vec3& invDir, HitInfo& info, ISceneObject* exclude) const;
+
+	gml::vec3 mCenter;
+	gml::vec3 mHalfSize;
+	gml::aabb mLooseAABB;	//cell expanded by half size on each side.
 	SceneNode* mParent = nullptr;
+	int mLevel;
 	SceneNode* mChildren[8];
-	std::vector<ISceneObject*> mObjects;
+	ISceneObject** mObjects = nullptr;
+	int mObjectCount = 0;
+
+};
+
+class Octree : public Accelerator
+{
+public:
+	virtual void Build(const std::vector<ISceneObject*>& objects);
+
+	virtual ISceneObject* IntersectWithRay(const gml::ray& ray, HitInfo& info, ISceneObject* exclude) const;
+
+	virtual bool QueryObjects(const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count) const;
 
+private:
+	Arena mArena;
+	SceneNode* mRoot = nullptr;
 };
 
 class Scene: public IScene
@@ -35,22 +57,46 @@ class Scene: public IScene
 public:
 	Scene();
 
+	Scene(SceneAccelerator accelerator);
+
 	~Scene();
 
+	bool Load(const char* path);
+
 	virtual void Update();
 
+	virtual void SetFrame(int frame);
+
 	virtual ISceneObject* IntersectWithRay(const gml::ray& ray, HitInfo& info, ISceneObject* exclude) const;
 
+	virtual int GetObjectCount() const;
+
+	virtual ISceneObject* GetSceneObject(int index) const;
+
+	virtual bool QueryObjects(const IBoundsFilter& filter, ISceneObject** objects, int maxCount, int& count) const;
+
 	virtual const Light* GetLightList() const;
 
 	virtual int GetLightCount() const;
 
+	virtual int SampleLight(const gml::vec3& position, float u, float& pdf) const;
+
 	virtual const gml::color3& GetAmbientColor() const;
 
 private:
-	SceneNode* mSceneRoot = nullptr;
+	bool LoadSnapshot();
+	void SetLights(const LightRecord* lights, int count);
+
+	Accelerator* mAccelerator = nullptr;
+	std::vector<ISceneObject*> mObjects;
+	Arena mArena;	//objects, released all at once with the scene
+	MappedFile mSnapshot;
+	std::vector<ISceneObject*> mParticles;
 	std::vector<Light> mLights;
-	float mRandomSeed;
+	LightTree mLightTree;
+	int mFrame = 0;
+	float mRandomSeed = 0.5f;
+	bool mAnimateLight = false;
 
 	gml::color3 mAmbientColor = gml::color3(0.1f, 0.125f, 0.125f);
 };
\ No newline at end of file
@@ -0,0 +1,274 @@
+#include "pch.h"
+#include <stdlib.h>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include "scenefile.h"
+#include "sceneobject.h"
+#include "bvh4.h"
+#include "arena.h"
+
+namespace
+{
+	unsigned int AlignOffset(unsigned int offset)
+	{
+		return (offset + SNAPSHOT_ALIGNMENT - 1) & ~(SNAPSHOT_ALIGNMENT - 1);
+	}
+
+	bool ReadFloats(const std::vector<std::string>& tokens, size_t& index, float* values, int count)
+	{
+		for (int i = 0; i < count; i++, index++)
+		{
+			if (index >= tokens.size())
+			{
+				return false;
+			}
+
+			char* end;
+			values[i] = strtof(tokens[index].c_str(), &end);
+			if (*end != '\0')
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//optional trailing numbers, stops at the first word that is not one.
+	void ReadOptionalFloats(const std::vector<std::string>& tokens, size_t& index, float* values, int count)
+	{
+		for (int i = 0; i < count && index < tokens.size(); i++)
+		{
+			char* end;
+			float value = strtof(tokens[index].c_str(), &end);
+			if (*end != '\0' || end == tokens[index].c_str())
+			{
+				return;
+			}
+			values[i] = value;
+			index++;
+		}
+	}
+
+	bool ParseObject(const std::string& keyword, const std::vector<std::string>& tokens, ObjectRecord& record)
+	{
+		//parameter counts per type: required, then optional.
+		int required, optional;
+		if (keyword == "sphere")		{ record.Type = static_cast<int>(ObjectType::Sphere);	required = 1; optional = 0; }
+		else if (keyword == "plane")	{ record.Type = static_cast<int>(ObjectType::Plane);	required = 3; optional = 0; }
+		else if (keyword == "box")		{ record.Type = static_cast<int>(ObjectType::Box);		required = 3; optional = 0; }
+		else if (keyword == "pyramid")	{ record.Type = static_cast<int>(ObjectType::Pyramid);	required = 1; optional = 0; }
+		else if (keyword == "model")	{ record.Type = static_cast<int>(ObjectType::Model);	required = 1; optional = 1; }
+		else
+		{
+			return false;
+		}
+
+		size_t index = 1;
+		if (!ReadFloats(tokens, index, record.Position, 3) ||
+			!ReadFloats(tokens, index, record.Params, required))
+		{
+			return false;
+		}
+		ReadOptionalFloats(tokens, index, record.Params + required, optional);
+
+		for (; index < tokens.size(); index++)
+		{
+			if (tokens[index] == "reflective")
+			{
+				record.Flags |= OBJECT_REFLECTIVE;
+			}
+			else if (tokens[index] == "transparent")
+			{
+				record.Flags |= OBJECT_TRANSPARENT;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool ParseLight(const std::vector<std::string>& tokens, LightRecord& record)
+	{
+		size_t index = 1;
+		if (!ReadFloats(tokens, index, record.Position, 3) ||
+			!ReadFloats(tokens, index, record.Color, 3) ||
+			!ReadFloats(tokens, index, &(record.Intensity), 1))
+		{
+			return false;
+		}
+		ReadOptionalFloats(tokens, index, &(record.Range), 1);
+		return index == tokens.size();
+	}
+
+	void WriteSection(std::ofstream& file, unsigned int& cursor, unsigned int offset, const void* data, size_t size)
+	{
+		static const char PADDING[SNAPSHOT_ALIGNMENT] = { 0 };
+		file.write(PADDING, offset - cursor);
+		file.write(static_cast<const char*>(data), size);
+		cursor = offset + static_cast<unsigned int>(size);
+	}
+}
+
+bool ParseSceneText(const char* path, SceneDescription& desc)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+		{
+			line.erase(comment);
+		}
+
+		std::istringstream stream(line);
+		std::vector<std::string> tokens;
+		std::string token;
+		while (stream >> token)
+		{
+			tokens.push_back(token);
+		}
+		if (tokens.empty())
+		{
+			continue;
+		}
+
+		if (tokens[0] == "ambient")
+		{
+			size_t index = 1;
+			if (!ReadFloats(tokens, index, desc.Ambient, 3) || index != tokens.size())
+			{
+				return false;
+			}
+		}
+		else if (tokens[0] == "light")
+		{
+			LightRecord light = {};
+			if (!ParseLight(tokens, light))
+			{
+				return false;
+			}
+			desc.Lights.push_back(light);
+		}
+		else
+		{
+			ObjectRecord object = {};
+			if (!ParseObject(tokens[0], tokens, object))
+			{
+				return false;
+			}
+			desc.Objects.push_back(object);
+		}
+	}
+	return true;
+}
+
+bool WriteSnapshot(const char* path, const SceneDescription& desc)
+{
+	Arena arena;
+	std::vector<ISceneObject*> objects;
+	for (const ObjectRecord& record : desc.Objects)
+	{
+		ISceneObject* object = CreateSceneObject(record, arena);
+		if (object == nullptr)
+		{
+			return false;
+		}
+		objects.push_back(object);
+	}
+
+	Bvh4Accelerator accelerator;
+	accelerator.Build(objects);
+	const Bvh4& bvh = accelerator.GetBvh();
+
+	SnapshotHeader header = {};
+	header.Magic = SNAPSHOT_MAGIC;
+	header.Version = SNAPSHOT_VERSION;
+	for (int i = 0; i < 3; i++)
+	{
+		header.Ambient[i] = desc.Ambient[i];
+	}
+
+	header.ObjectCount = static_cast<int>(desc.Objects.size());
+	header.ObjectOffset = AlignOffset(sizeof(SnapshotHeader));
+	header.LightCount = static_cast<int>(desc.Lights.size());
+	header.LightOffset = AlignOffset(header.ObjectOffset + header.ObjectCount * sizeof(ObjectRecord));
+	header.NodeSize = Bvh4::GetNodeSize();
+	header.NodeCount = bvh.GetNodeCount();
+	header.NodeOffset = AlignOffset(header.LightOffset + header.LightCount * sizeof(LightRecord));
+	header.PrimitiveCount = bvh.GetPrimitiveCount();
+	header.PrimitiveOffset = AlignOffset(header.NodeOffset + header.NodeCount * header.NodeSize);
+	header.FileSize = header.PrimitiveOffset + header.PrimitiveCount * sizeof(int);
+
+	std::ofstream file(path, std::ios::binary);
+	if (file)
+	{
+		unsigned int cursor = 0;
+		WriteSection(file, cursor, 0, &header, sizeof(header));
+		WriteSection(file, cursor, header.ObjectOffset, desc.Objects.data(), header.ObjectCount * sizeof(ObjectRecord));
+		WriteSection(file, cursor, header.LightOffset, desc.Lights.data(), header.LightCount * sizeof(LightRecord));
+		WriteSection(file, cursor, header.NodeOffset, bvh.GetNodes(), header.NodeCount * header.NodeSize);
+		WriteSection(file, cursor, header.PrimitiveOffset, bvh.GetPrimitives(), header.PrimitiveCount * sizeof(int));
+	}
+	return file.good();
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const char* path)
+{
+	Close();
+
+	mFile = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	LARGE_INTEGER size;
+	if (mFile == INVALID_HANDLE_VALUE || !::GetFileSizeEx(mFile, &size) || size.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	mMapping = ::CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping != NULL)
+	{
+		mView = static_cast<const unsigned char*>(::MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+	}
+	if (mView == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	mSize = static_cast<size_t>(size.QuadPart);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (mView != nullptr)
+	{
+		::UnmapViewOfFile(mView);
+		mView = nullptr;
+	}
+	if (mMapping != NULL)
+	{
+		::CloseHandle(mMapping);
+		mMapping = NULL;
+	}
+	if (mFile != INVALID_HANDLE_VALUE)
+	{
+		::CloseHandle(mFile);
+		mFile = INVALID_HANDLE_VALUE;
+	}
+	mSize = 0;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <vector>
+
+//binary snapshot layout, every section is a plain array at its offset from the file start.
+const unsigned int SNAPSHOT_MAGIC = 0x53495350;	//"PSIS"
+const unsigned int SNAPSHOT_VERSION = 1;
+const unsigned int SNAPSHOT_ALIGNMENT = 16;
+
+enum class ObjectType
+{
+	Sphere,
+	Plane,
+	Box,
+	Pyramid,
+	Model,
+};
+
+enum ObjectFlag
+{
+	OBJECT_REFLECTIVE = 1,
+	OBJECT_TRANSPARENT = 2,
+};
+
+struct ObjectRecord
+{
+	int Type;
+	unsigned int Flags;
+	float Position[3];
+	float Params[4];	//sphere radius, plane normal, box extends, pyramid extend, model size and yaw
+};
+
+struct LightRecord
+{
+	float Position[3];
+	float Color[3];
+	float Intensity;
+	float Range;
+};
+
+struct SnapshotHeader
+{
+	unsigned int Magic;
+	unsigned int Version;
+	unsigned int FileSize;
+	float Ambient[3];
+
+	int ObjectCount;
+	unsigned int ObjectOffset;
+	int LightCount;
+	unsigned int LightOffset;
+
+	//top level bvh4 over the bounded objects, used in place after loading.
+	int NodeSize;
+	int NodeCount;
+	unsigned int NodeOffset;
+	int PrimitiveCount;
+	unsigned int PrimitiveOffset;
+};
+
+struct SceneDescription
+{
+	float Ambient[3] = { 0.1f, 0.125f, 0.125f };
+	std::vector<ObjectRecord> Objects;
+	std::vector<LightRecord> Lights;
+};
+
+//one statement per line, '#' starts a comment:
+//	ambient r g b
+//	sphere x y z radius [reflective] [transparent]
+//	plane x y z nx ny nz
+//	box x y z ex ey ez
+//	pyramid x y z extend
+//	model x y z size [yaw]
+//	light x y z r g b intensity [range]
+bool ParseSceneText(const char* path, SceneDescription& desc);
+
+//builds the top level bvh from the description and writes everything in one file.
+bool WriteSnapshot(const char* path, const SceneDescription& desc);
+
+//read-only view of a whole file, kept open while the data is used in place.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator = (const MappedFile&) = delete;
+
+	bool Open(const char* path);
+
+	void Close();
+
+	inline const unsigned char* GetData() const { return mView; }
+
+	inline size_t GetSize() const { return mSize; }
+
+private:
+	HANDLE mFile = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = NULL;
+	const unsigned char* mView = nullptr;
+	size_t mSize = 0;
+};
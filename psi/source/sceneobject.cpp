@@ -1,6 +1,9 @@
 #include "pch.h"
 #include <math.h>
 #include "sceneobject.h"
+#include "scenefile.h"
+#include "arena.h"
+#include "mesh.h"
 #include <limits>
 #include <gmlray.h>
 
@@ -20,9 +23,41 @@ ISceneObject* ISceneObject::CreatePyramid(const gml::vec3& position, float exten
 {
 	return new PyramidSceneObject(position, extends);
 }
-ISceneObject* ISceneObject::CreateModel(const gml::vec3& position, float size)
+ISceneObject* ISceneObject::CreateModel(const gml::vec3& position, float size, float yaw)
 {
-	return new ModelSceneObject(position, size);
+	return new ModelSceneObject(GetTeapotMesh(), position, size, yaw);
+}
+
+ISceneObject* CreateSceneObject(const ObjectRecord& record, Arena& arena)
+{
+	gml::vec3 position(record.Position[0], record.Position[1], record.Position[2]);
+	const float* params = record.Params;
+
+	ISceneObject* object;
+	switch (static_cast<ObjectType>(record.Type))
+	{
+	case ObjectType::Sphere:
+		object = arena.New<SphereSceneObject>(position, params[0]);
+		break;
+	case ObjectType::Plane:
+		object = arena.New<PlaneSceneObject>(position, gml::vec3(params[0], params[1], params[2]));
+		break;
+	case ObjectType::Box:
+		object = arena.New<BoxSceneObject>(position, gml::vec3(params[0], params[1], params[2]));
+		break;
+	case ObjectType::Pyramid:
+		object = arena.New<PyramidSceneObject>(position, params[0]);
+		break;
+	case ObjectType::Model:
+		object = arena.New<ModelSceneObject>(GetTeapotMesh(), position, params[0], params[1]);
+		break;
+	default:
+		return nullptr;
+	}
+
+	object->GetMaterial()->IsReflective = (record.Flags & OBJECT_REFLECTIVE) != 0;
+	object->GetMaterial()->IsTransparent = (record.Flags & OBJECT_TRANSPARENT) != 0;
+	return object;
 }
 
 
@@ -52,6 +87,13 @@ const Material* SceneObject::GetMaterial() const
 	return &mMaterial;
 }
 
+void SceneObject::ComputeSurface(const gml::ray& ray, const HitInfo& info, SurfaceInfo& surface) const
+{
+	surface.position = ray.get_offset(info.t);
+	surface.normal = GetNormal(surface.position, info);
+	surface.material = &mMaterial;
+}
+
 const gml::vec3& SphereSceneObject::GetPosition() const
 {
 	return mSphere.GetCenter();
@@ -61,19 +103,28 @@ const gml::vec3& SphereSceneObject::GetPosition() const
 //
 SphereSceneObject::SphereSceneObject(const gml::vec3& position, float radius) :mSphere(position, radius)
 {
+	UpdateAABB();
+}
+
+void SphereSceneObject::UpdateAABB()
+{
+	float radius = mSphere.GetRadius();
 	gml::vec3 r = gml::vec3(radius, radius, radius);
-	mAABB.expand(position + r);
-	mAABB.expand(position - r);
+	mAABB = gml::aabb();
+	mAABB.expand(mSphere.GetCenter() + r);
+	mAABB.expand(mSphere.GetCenter() - r);
 }
 
 void SphereSceneObject::SetPosition(float x, float y, float z)
 {
 	mSphere.SetCenter(x, y, z);
+	UpdateAABB();
 }
 
 void SphereSceneObject::SetPosition(const gml::vec3& center)
 {
 	mSphere.SetCenter(center);
+	UpdateAABB();
 }
 
 bool SphereSceneObject::IntersectWithRay(const gml::ray& ray, float mint, HitInfo& info) const
@@ -82,7 +133,6 @@ bool SphereSceneObject::IntersectWithRay(const gml::ray& ray, float mint, HitInf
 	if (Intersect(ray, mSphere, t0, t1) > 0 && t0 < mint)
 	{
 		info.t = t0;
-		info.normal = (ray.get_offset(t0) - mSphere.GetCenter()).normalized();
 		return true;
 	}
 	else
@@ -91,6 +141,11 @@ bool SphereSceneObject::IntersectWithRay(const gml::ray& ray, float mint, HitInf
 	}
 }
 
+gml::vec3 SphereSceneObject::GetNormal(const gml::vec3& position, const HitInfo& info) const
+{
+	return (position - mSphere.GetCenter()).normalized();
+}
+
 //////////////////////////////////////////////
 //
 
@@ -111,12 +166,16 @@ bool PlaneSceneObject::IntersectWithRay(const gml::ray& ray, float mint, HitInfo
 	if (Intersect(ray, mPlane, t) > 0 && t < mint)
 	{
 		info.t = t;
-		info.normal = mPlane.GetNormal();
 		return true;
 	}
 	return false;
 }
 
+gml::vec3 PlaneSceneObject::GetNormal(const gml::vec3& position, const HitInfo& info) const
+{
+	return mPlane.GetNormal();
+}
+
 void PlaneSceneObject::SetPosition(float x, float y, float z)
 {
 	mPlane.SetPosition(x, y, z);
@@ -136,6 +195,14 @@ const gml::vec3& PlaneSceneObject::GetPosition() const
 
 BoxSceneObject::BoxSceneObject(const gml::vec3& position, const gml::vec3& extend) : mBox(position, extend)
 {
+	UpdateAABB();
+}
+
+void BoxSceneObject::UpdateAABB()
+{
+	const gml::vec3& position = mBox.GetCenter();
+	const gml::vec3& extend = mBox.GetExtend();
+	mAABB = gml::aabb();
 	mAABB.expand(position + mBox.GetAxisX() * extend.x);
 	mAABB.expand(position - mBox.GetAxisX() * extend.x);
 	mAABB.expand(position + mBox.GetAxisY() * extend.y);
@@ -150,50 +217,54 @@ bool BoxSceneObject::IntersectWithRay(const gml::ray& ray, float mint, HitInfo&
 	if (Intersect(ray, mBox, t0, t1) > 0 && t0 < mint)
 	{
 		info.t = t0;
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
 
-		gml::vec3 iNormal = (ray.get_offset(info.t) - mBox.GetCenter()).normalized();
-		float absX = fabs(dot(iNormal, mBox.GetAxisX())) / mBox.GetExtend().x;
-		float absY = fabs(dot(iNormal, mBox.GetAxisY())) / mBox.GetExtend().y;
-		float absZ = fabs(dot(iNormal, mBox.GetAxisZ())) / mBox.GetExtend().z;
-		if (absX > absY)
+gml::vec3 BoxSceneObject::GetNormal(const gml::vec3& position, const HitInfo& info) const
+{
+	gml::vec3 iNormal = (position - mBox.GetCenter()).normalized();
+	float absX = fabs(dot(iNormal, mBox.GetAxisX())) / mBox.GetExtend().x;
+	float absY = fabs(dot(iNormal, mBox.GetAxisY())) / mBox.GetExtend().y;
+	float absZ = fabs(dot(iNormal, mBox.GetAxisZ())) / mBox.GetExtend().z;
+	if (absX > absY)
+	{
+		if (absX > absZ)
 		{
-			if (absX > absZ)
-			{
-				info.normal = iNormal.x > 0 ? mBox.GetAxisX() : -mBox.GetAxisX();
-			}
-			else
-			{
-				info.normal = iNormal.z > 0 ? mBox.GetAxisZ() : -mBox.GetAxisZ();
-			}
+			return iNormal.x > 0 ? mBox.GetAxisX() : -mBox.GetAxisX();
 		}
 		else
 		{
-			if (absY > absZ)
-			{
-				info.normal = iNormal.y > 0 ? mBox.GetAxisY() : -mBox.GetAxisY();
-			}
-			else
-			{
-				info.normal = iNormal.z > 0 ? mBox.GetAxisZ() : -mBox.GetAxisZ();
-			}
+			return iNormal.z > 0 ? mBox.GetAxisZ() : -mBox.GetAxisZ();
 		}
-
-		return true;
 	}
 	else
 	{
-		return false;
+		if (absY > absZ)
+		{
+			return iNormal.y > 0 ? mBox.GetAxisY() : -mBox.GetAxisY();
+		}
+		else
+		{
+			return iNormal.z > 0 ? mBox.GetAxisZ() : -mBox.GetAxisZ();
+		}
 	}
 }
 
 void BoxSceneObject::SetPosition(float x, float y, float z)
 {
 	mBox.SetCenter(x, y, z);
+	UpdateAABB();
 }
 
 void BoxSceneObject::SetPosition(const gml::vec3& center)
 {
 	mBox.SetCenter(center);
+	UpdateAABB();
 }
 
 const gml::vec3& BoxSceneObject::GetPosition() const
@@ -214,7 +285,16 @@ PyramidSceneObject::PyramidSceneObject(const gml::vec3& position, float extend)
 	for (int i = 0; i < 4; i++)
 	{
 		mVerts[i] = VERTS[i] * extend;
-		mAABB.expand(mVerts[i]);
+	}
+	UpdateAABB();
+}
+
+void PyramidSceneObject::UpdateAABB()
+{
+	mAABB = gml::aabb();
+	for (int i = 0; i < 4; i++)
+	{
+		mAABB.expand(mCenter + mVerts[i]);
 	}
 }
 
@@ -222,28 +302,21 @@ bool PyramidSceneObject::IntersectWithRay(const gml::ray& ray, float mint, HitIn
 {
 	bool found = false;
 	float t0, u, v;
-	gml::vec3 normal;
 	for (int i = 0; i < 12; i += 3)
 	{
 		if (IntersectTriangleWithRay(ray,
 			mCenter + mVerts[FACE[i]],
 			mCenter + mVerts[FACE[i + 1]],
 			mCenter + mVerts[FACE[i + 2]],
-			t0, u, v, normal))
+			t0, u, v))
 		{
-			if (found)
-			{
-				if (info.t > t0)
-				{
-					info.t = t0;
-					info.normal = normal;
-				}
-			}
-			else if (t0 < mint)
+			if ((found && info.t > t0) || (!found && t0 < mint))
 			{
 				found = true;
 				info.t = t0;
-				info.normal = normal;
+				info.primitive = i / 3;
+				info.u = u;
+				info.v = v;
 			}
 		}
 	}
@@ -251,13 +324,21 @@ bool PyramidSceneObject::IntersectWithRay(const gml::ray& ray, float mint, HitIn
 	return  found;
 }
 
+gml::vec3 PyramidSceneObject::GetNormal(const gml::vec3& position, const HitInfo& info) const
+{
+	int i = info.primitive * 3;
+	return GetTriangleNormal(mVerts[FACE[i]], mVerts[FACE[i + 1]], mVerts[FACE[i + 2]]);
+}
+
 void PyramidSceneObject::SetPosition(float x, float y, float z)
 {
 	mCenter.set(x, y, z);
+	UpdateAABB();
 }
 void PyramidSceneObject::SetPosition(const gml::vec3& center)
 {
 	mCenter = center;
+	UpdateAABB();
 }
 
 const gml::vec3& PyramidSceneObject::GetPosition() const
@@ -274,56 +355,75 @@ const int  TEAPOT_INDEX[] = { 1 - 1, 4 - 1, 5 - 1, 5 - 1, 2 - 1, 1 - 1, 2 - 1, 5
 const int TEAPOT_INDEX_COUNT = sizeof(TEAPOT_INDEX) / sizeof(int);
 const int TEAPOT_VERT_COUNT = 138;
 
-ModelSceneObject::ModelSceneObject(const gml::vec3& position, float size) :mCenter(position)
+const Mesh* GetTeapotMesh()
+{
+	static Mesh teapot(TEAPOT_VERTS, TEAPOT_VERT_COUNT, TEAPOT_INDEX, TEAPOT_INDEX_COUNT);
+	return &teapot;
+}
+
+ModelSceneObject::ModelSceneObject(const Mesh* mesh, const gml::vec3& position, float size, float yaw)
+	: mMesh(mesh)
+	, mCenter(position)
+	, mScale(size)
+	, mInvScale(1.0f / size)
+	, mCosYaw(cos(yaw))
+	, mSinYaw(sin(yaw))
+{
+	UpdateAABB();
+}
+
+gml::vec3 ModelSceneObject::RotateToObject(const gml::vec3& v) const
 {
+	return gml::vec3(mCosYaw * v.x - mSinYaw * v.z, v.y, mSinYaw * v.x + mCosYaw * v.z);
+}
+
+gml::vec3 ModelSceneObject::RotateToWorld(const gml::vec3& v) const
+{
+	return gml::vec3(mCosYaw * v.x + mSinYaw * v.z, v.y, -mSinYaw * v.x + mCosYaw * v.z);
+}
 
-	for (int i = 0; i < TEAPOT_VERT_COUNT; i++)
+void ModelSceneObject::UpdateAABB()
+{
+	const gml::aabb& local = mMesh->GetAABB();
+	mAABB = gml::aabb();
+	for (int i = 0; i < 8; i++)
 	{
-		mVerts[i].set(TEAPOT_VERTS[i * 3], TEAPOT_VERTS[i * 3 + 1], TEAPOT_VERTS[i * 3 + 2]);
-		mVerts[i] *= size;
-		mAABB.expand(mVerts[i]);
+		gml::vec3 corner(
+			(i & 1) ? local.max_bound().x : local.min_bound().x,
+			(i & 2) ? local.max_bound().y : local.min_bound().y,
+			(i & 4) ? local.max_bound().z : local.min_bound().z);
+		mAABB.expand(mCenter + RotateToWorld(corner) * mScale);
 	}
 }
 
 bool ModelSceneObject::IntersectWithRay(const gml::ray& ray, float mint, HitInfo& info) const
 {
-	bool found = false;
-	float t0, u, v;
-	gml::vec3 normal;
-	for (int i = 0; i < TEAPOT_INDEX_COUNT; i += 3)
+	//uniform scale keeps the object space direction unit length, only t scales.
+	gml::ray localRay;
+	localRay.set_origin(RotateToObject(ray.origin() - mCenter) * mInvScale);
+	localRay.set_dir(RotateToObject(ray.direction()));
+	if (mMesh->IntersectWithRay(localRay, mint * mInvScale, info))
 	{
-		if (IntersectTriangleWithRay(ray,
-			mCenter + mVerts[TEAPOT_INDEX[i]],
-			mCenter + mVerts[TEAPOT_INDEX[i + 1]],
-			mCenter + mVerts[TEAPOT_INDEX[i + 2]],
-			t0, u, v, normal))
-		{
-			if (found)
-			{
-				if (info.t > t0)
-				{
-					info.t = t0;
-					info.normal = normal;
-				}
-			}
-			else if (t0 < mint)
-			{
-				found = true;
-				info.t = t0;
-				info.normal = normal;
-			}
-		}
+		info.t *= mScale;
+		return true;
 	}
-	return found;
+	return false;
+}
+
+gml::vec3 ModelSceneObject::GetNormal(const gml::vec3& position, const HitInfo& info) const
+{
+	return RotateToWorld(mMesh->GetNormal(info.primitive));
 }
 
 void ModelSceneObject::SetPosition(float x, float y, float z)
 {
 	mCenter.set(x, y, z);
+	UpdateAABB();
 }
 void ModelSceneObject::SetPosition(const gml::vec3& center)
 {
 	mCenter = center;
+	UpdateAABB();
 }
 
 const gml::vec3& ModelSceneObject::GetPosition() const
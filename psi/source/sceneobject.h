@@ -16,9 +16,13 @@ public:
 
 	virtual const gml::aabb& GetAABB() const { return mAABB; }
 
+	virtual void ComputeSurface(const gml::ray& ray, const HitInfo& info, SurfaceInfo& surface) const;
+
 protected:
 	SceneObject();
 
+	virtual gml::vec3 GetNormal(const gml::vec3& position, const HitInfo& info) const = 0;
+
 	Material mMaterial;
 	gml::aabb mAABB;
 
@@ -38,7 +42,12 @@ public:
 
 	virtual const gml::vec3& GetPosition() const;
 
+protected:
+	virtual gml::vec3 GetNormal(const gml::vec3& position, const HitInfo& info) const;
+
 private:
+	void UpdateAABB();
+
 	Sphere mSphere;
 };
 
@@ -55,6 +64,9 @@ public:
 
 	virtual const gml::vec3& GetPosition() const;
 
+protected:
+	virtual gml::vec3 GetNormal(const gml::vec3& position, const HitInfo& info) const;
+
 private:
 	Plane mPlane;
 };
@@ -72,7 +84,12 @@ public:
 
 	virtual const gml::vec3& GetPosition() const;
 
+protected:
+	virtual gml::vec3 GetNormal(const gml::vec3& position, const HitInfo& info) const;
+
 private:
+	void UpdateAABB();
+
 	Box mBox;
 };
 
@@ -89,7 +106,12 @@ public:
 
 	virtual const gml::vec3& GetPosition() const;
 
+protected:
+	virtual gml::vec3 GetNormal(const gml::vec3& position, const HitInfo& info) const;
+
 private:
+	void UpdateAABB();
+
 	gml::vec3 mCenter;
 	gml::vec3 mVerts[4];
 
@@ -98,10 +120,13 @@ public:
 	static const int FACE[12];
 };
 
+class Mesh;
+
+//instance of a shared mesh, placed by position, uniform scale and rotation around y.
 class ModelSceneObject : public SceneObject
 {
 public:
-	ModelSceneObject(const gml::vec3& position, float size);
+	ModelSceneObject(const Mesh* mesh, const gml::vec3& position, float size, float yaw);
 
 	virtual bool IntersectWithRay(const gml::ray& ray, float mint, HitInfo& info) const;
 
@@ -111,7 +136,29 @@ public:
 
 	virtual const gml::vec3& GetPosition() const;
 
+protected:
+	virtual gml::vec3 GetNormal(const gml::vec3& position, const HitInfo& info) const;
+
 private:
+	void UpdateAABB();
+
+	gml::vec3 RotateToObject(const gml::vec3& v) const;
+
+	gml::vec3 RotateToWorld(const gml::vec3& v) const;
+
+	const Mesh* mMesh;
 	gml::vec3 mCenter;
-	gml::vec3 mVerts[138];
-};
\ No newline at end of file
+	float mScale;
+	float mInvScale;
+	float mCosYaw;
+	float mSinYaw;
+};
+
+struct ObjectRecord;
+class Arena;
+
+//shared by every teapot instance.
+const Mesh* GetTeapotMesh();
+
+//objects placed in an arena go away with it, Release must not be called on them.
+ISceneObject* CreateSceneObject(const ObjectRecord& record, Arena& arena);
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include "pch.h"
+#include "threadpool.h"
+
+ThreadPool& ThreadPool::Get()
+{
+	static ThreadPool pool(static_cast<int>(std::thread::hardware_concurrency()) - 1);
+	return pool;
+}
+
+ThreadPool::ThreadPool(int workerCount)
+{
+	for (int i = 0; i < workerCount; i++)
+	{
+		mWorkers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mWake.notify_all();
+	for (auto& t : mWorkers)
+	{
+		t.join();
+	}
+}
+
+void ThreadPool::Submit(const std::shared_ptr<Job>& job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJobs.push_back(job);
+	}
+	mWake.notify_all();
+}
+
+void ThreadPool::Wait(Job& job)
+{
+	int index;
+	while ((index = job.Next++) < job.Count)
+	{
+		job.Func(index);
+		job.Done++;
+	}
+
+	//items claimed by workers are still running, lend a hand elsewhere meanwhile.
+	while (job.Done < job.Count)
+	{
+		if (!RunOne())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+bool ThreadPool::RunOne()
+{
+	std::shared_ptr<Job> job;
+	int index = 0;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		while (!mJobs.empty())
+		{
+			index = mJobs.front()->Next++;
+			if (index < mJobs.front()->Count)
+			{
+				job = mJobs.front();
+				break;
+			}
+			mJobs.pop_front();
+		}
+	}
+
+	if (job == nullptr)
+	{
+		return false;
+	}
+
+	job->Func(index);
+	job->Done++;
+	return true;
+}
+
+void ThreadPool::WorkerLoop()
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [this] { return mStop || !mJobs.empty(); });
+			if (mStop)
+			{
+				return;
+			}
+		}
+		RunOne();
+	}
+}
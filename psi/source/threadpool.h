@@ -0,0 +1,93 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+//workers shared by rendering and acceleration structure builds.
+class ThreadPool
+{
+public:
+	static ThreadPool& Get();
+
+	explicit ThreadPool(int workerCount);
+
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator = (const ThreadPool&) = delete;
+
+	//workers plus the calling thread.
+	inline int GetThreadCount() const { return static_cast<int>(mWorkers.size()) + 1; }
+
+	//runs func(i) for every i in [0, count). the caller works on its own items first,
+	//then helps other jobs while waiting, so nested calls from inside a job are safe.
+	template<typename Func>
+	void ParallelFor(int count, const Func& func);
+
+	//queues func(i) for every i in [0, count) and returns at once. the items run on
+	//workers and on threads waiting in ParallelFor, so this needs at least one worker.
+	template<typename Func>
+	void Post(int count, const Func& func);
+
+private:
+	struct Job
+	{
+		std::function<void(int)> Func;
+		int Count = 0;
+		std::atomic<int> Next;
+		std::atomic<int> Done;
+	};
+
+	void Submit(const std::shared_ptr<Job>& job);
+	void Wait(Job& job);
+	bool RunOne();
+	void WorkerLoop();
+
+	std::vector<std::thread> mWorkers;
+	std::deque<std::shared_ptr<Job>> mJobs;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	bool mStop = false;
+};
+
+template<typename Func>
+void ThreadPool::ParallelFor(int count, const Func& func)
+{
+	if (count <= 1 || mWorkers.empty())
+	{
+		for (int i = 0; i < count; i++)
+		{
+			func(i);
+		}
+		return;
+	}
+
+	std::shared_ptr<Job> job = std::make_shared<Job>();
+	job->Func = func;
+	job->Count = count;
+	job->Next = 0;
+	job->Done = 0;
+	Submit(job);
+	Wait(*job);
+}
+
+template<typename Func>
+void ThreadPool::Post(int count, const Func& func)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	std::shared_ptr<Job> job = std::make_shared<Job>();
+	job->Func = func;
+	job->Count = count;
+	job->Next = 0;
+	job->Done = 0;
+	Submit(job);
+}
@@ -1,5 +1,10 @@
 #include "pch.h"
+#include <string>
+#include <shellapi.h>
 #include "psi.h"
+#include "iscene.h"
+#include "renderfarm.h"
+#include "imagewriter.h"
 #include "../resource/resource.h"
 
 namespace
@@ -8,6 +13,57 @@ namespace
 	const wchar_t* APP_NAME = L"psi";
 	HINSTANCE hInst;
 	HWND hWindow;
+
+	std::string ToAnsi(const wchar_t* text)
+	{
+		int length = ::WideCharToMultiByte(CP_ACP, 0, text, -1, NULL, 0, NULL, NULL);
+		std::string result(length > 0 ? length - 1 : 0, '\0');
+		if (length > 1)
+		{
+			::WideCharToMultiByte(CP_ACP, 0, text, -1, &(result[0]), length, NULL, NULL);
+		}
+		return result;
+	}
+
+	int RenderOnFarm(int argc, wchar_t** argv)
+	{
+		const unsigned short DEFAULT_FARM_PORT = 7788;
+
+		std::string scenePath = ToAnsi(argv[2]);
+		std::string outputPath = ToAnsi(argv[3]);
+		int width = _wtoi(argv[4]);
+		int height = _wtoi(argv[5]);
+		//every worker process fills all cores with its own thread pool, one is enough on this machine.
+		int workerCount = argc > 6 ? _wtoi(argv[6]) : 1;
+		unsigned short port = argc > 7 ? static_cast<unsigned short>(_wtoi(argv[7])) : DEFAULT_FARM_PORT;
+		if (width <= 0 || height <= 0)
+		{
+			return 1;
+		}
+
+		ImageWriter writer;
+		std::vector<unsigned char> image;
+		RenderView view;
+		view.Width = width;
+		view.Height = height;
+		view.Pitch = width * 3;
+
+		FarmCoordinator farm;
+		if (!farm.Listen(port) || !farm.SpawnLocalWorkers(workerCount) ||
+			!writer.Open(ImageFormat::Ppm, outputPath.c_str(), width, height, 1, 1))
+		{
+			return 1;
+		}
+
+		image = writer.Acquire();
+		view.Buffer = image.data();
+		if (!farm.Render(scenePath.c_str(), 0, view))
+		{
+			return 1;
+		}
+		writer.Push(0, std::move(image));
+		return writer.Close() ? 0 : 1;
+	}
 }
 
 ATOM MyRegisterClass(HINSTANCE hInstance);
@@ -22,9 +78,44 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 	UNREFERENCED_PARAMETER(hPrevInstance);
 	UNREFERENCED_PARAMETER(lpCmdLine);
 
+	//psi.exe [scene]				renders a text scene or a snapshot
+	//psi.exe -convert text snapshot	writes a snapshot and exits
+	//psi.exe -farm scene output.ppm width height [workers] [port]
+	//								renders one frame on worker processes, more may join from other machines
+	//psi.exe -farm-worker host port	serves a farm coordinator
+	int argc = 0;
+	wchar_t** argv = ::CommandLineToArgvW(::GetCommandLineW(), &argc);
+	std::string scenePath;
+	if (argv != NULL)
+	{
+		if (argc == 4 && wcscmp(argv[1], L"-convert") == 0)
+		{
+			bool converted = IScene::Convert(ToAnsi(argv[2]).c_str(), ToAnsi(argv[3]).c_str());
+			::LocalFree(argv);
+			return converted ? 0 : 1;
+		}
+		if (argc >= 6 && wcscmp(argv[1], L"-farm") == 0)
+		{
+			int result = RenderOnFarm(argc, argv);
+			::LocalFree(argv);
+			return result;
+		}
+		if (argc == 4 && wcscmp(argv[1], L"-farm-worker") == 0)
+		{
+			bool served = RunFarmWorker(ToAnsi(argv[2]).c_str(), static_cast<unsigned short>(_wtoi(argv[3])));
+			::LocalFree(argv);
+			return served ? 0 : 1;
+		}
+		if (argc > 1)
+		{
+			scenePath = ToAnsi(argv[1]);
+		}
+		::LocalFree(argv);
+	}
+
 	MyRegisterClass(hInstance);
 	if (!InitInstance(hInstance, nCmdShow) ||
-		!Initialize(hWindow))
+		!Initialize(hWindow, scenePath.empty() ? nullptr : scenePath.c_str()))
 	{
 		return FALSE;
 	}